@@ -0,0 +1,686 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "bus.h"
+#include "trace.h"
+
+#ifdef RASPBERRYPI
+#include <bsp/i2c.h>
+#else
+void simulator(char *request, char *answer);
+#ifdef HOST_SIM
+void simulator_send(const char *request);
+void simulator_receive(char *answer);
+#endif
+#endif
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+// Ready polling: first wait and maximum wait between two reads
+#define POLL_FIRST_NS 1000000
+#define POLL_MAX_NS   50000000
+
+// Actuators of the ACT frame, in the order of its characters
+#define ACT_GAS 0
+#define ACT_BRK 1
+#define ACT_LAM 2
+#define NUM_ACTS 3
+
+// Whether the transport can queue requests: the I2C bus and the back
+// ends of the host build can, the RTEMS simulator answers one request
+// at a time
+#if defined(RASPBERRYPI) || defined(HOST_SIM)
+#define BUS_QUEUES 1
+#else
+#define BUS_QUEUES 0
+#endif
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+// Last actuator frame the slave acknowledged
+struct bus_shadow {
+    int valid;
+    char frame[MSG_BUF];
+    char answer[MSG_BUF];
+    nsec_t time;
+};
+
+// State of the gas, brake and lamps of the slave. All their frames
+// also write the acceleration of the Arduino, each sketch in its
+// own way, so the acceleration is only known to be the same when
+// the last frame acknowledged is sent again.
+struct bus_act_shadow {
+    char state[NUM_ACTS];   // '0', '1', '?' if unknown
+    char frame[MSG_BUF];    // last frame acknowledged, "" if unknown
+    char answer[MSG_BUF];
+    nsec_t time;
+};
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+// Pre-built request frames, one per command
+static const char bus_frames[BUS_NUM_CMDS][MSG_BUF] = {
+    "SPD: REQ\n",
+    "SLP: REQ\n",
+    "GAS: SET\n",
+    "GAS: CLR\n",
+    "BRK: SET\n",
+    "BRK: CLR\n",
+    "MIX: SET\n",
+    "MIX: CLR\n",
+    "LIT: REQ\n",
+    "LAM: SET\n",
+    "LAM: CLR\n",
+    "STP: REQ\n",
+    "DS:  REQ\n",
+    "ERR: SET\n",
+    "CAP: REQ\n",
+    "SNS: REQ\n",
+    "ACT: ---\n",
+    "REG:READ\n",  // name only, the frame is a select byte
+};
+
+// Length of the answer of each command
+static const int bus_answer_len[BUS_NUM_CMDS] = {
+    MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN,
+    MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN, MSG_LEN,
+    MSG_LEN, MSG_LONG_LEN, MSG_LEN, BUS_REG_SIZE + 1,
+};
+
+// Time between the write of a request and the read of its answer,
+// and the bound of the ready polling
+static nsec_t time_msg = 400 * NS_PER_MS;
+#ifdef RASPBERRYPI
+static int fd_i2c = -1;
+#endif
+static struct bus_stats stats[BUS_NUM_CMDS];
+// One exchange at a time when several threads share the bus
+static pthread_mutex_t bus_lock;
+static int caps = 0;
+
+// Shadows of GAS, BRK, LAM and ACT together, and of MIX
+static struct bus_act_shadow act_shadow;
+static struct bus_shadow mix_shadow;
+static nsec_t refresh = BUS_REFRESH_NS;
+
+// Frames of the actuators of ACT, by BUS_ACT_CLR and BUS_ACT_SET
+static const int act_cmds[NUM_ACTS][2] = {
+    {BUS_GAS_CLR, BUS_GAS_SET},
+    {BUS_BRK_CLR, BUS_BRK_SET},
+    {BUS_LAM_CLR, BUS_LAM_SET},
+};
+
+/**********************************************************
+ *  Function: bus_init
+ *********************************************************/
+void bus_init()
+{
+    pthread_mutexattr_t attr;
+
+    memset(stats, 0, sizeof(stats));
+    memset(&act_shadow, 0, sizeof(act_shadow));
+    memset(act_shadow.state, '?', NUM_ACTS);
+    memset(&mix_shadow, 0, sizeof(mix_shadow));
+
+    // Priority inheritance: a slow poll holding the bus runs at
+    // the priority of the most urgent task waiting for it
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&bus_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+#ifdef RASPBERRYPI
+    // Init the i2C driver
+    rpi_i2c_init();
+
+    // bus registering, this init the ports needed for the conexion
+    // and register the device under /dev/i2c
+    rpi_i2c_register_bus("/dev/i2c", 10000);
+
+    // open device file
+    fd_i2c = open("/dev/i2c", O_RDWR);
+
+    // register the address of the slave to comunicate with
+    ioctl(fd_i2c, I2C_SLAVE, SLAVE_ADDR);
+#endif
+}
+
+/**********************************************************
+ *  Function: bus_set_msg_delay
+ *********************************************************/
+void bus_set_msg_delay(nsec_t delay)
+{
+    time_msg = delay;
+}
+
+/**********************************************************
+ *  Function: bus_set_refresh
+ *
+ *  0 sends every actuator command.
+ *********************************************************/
+void bus_set_refresh(nsec_t value)
+{
+    refresh = value;
+}
+
+/**********************************************************
+ *  Function: bus_shadow_act
+ *
+ *  Actuator of ACT that cmd sets, -1 for the others.
+ *********************************************************/
+static int bus_shadow_act(int cmd)
+{
+    switch (cmd) {
+        case BUS_GAS_SET: case BUS_GAS_CLR: return ACT_GAS;
+        case BUS_BRK_SET: case BUS_BRK_CLR: return ACT_BRK;
+        case BUS_LAM_SET: case BUS_LAM_CLR: return ACT_LAM;
+    }
+    return -1;
+}
+
+/**********************************************************
+ *  Function: bus_shadow_hit
+ *
+ *  Whether frame, of cmd, sets again the state the slave
+ *  acknowledged last, while it is younger than the refresh
+ *  interval. Copies the answer given then into answer.
+ *  Called with the bus locked.
+ *********************************************************/
+static int bus_shadow_hit(int cmd, const char *frame, char *answer)
+{
+    const char *last, *last_answer;
+    nsec_t time;
+
+    if (cmd == BUS_MIX_SET || cmd == BUS_MIX_CLR) {
+        if (!mix_shadow.valid)
+            return 0;
+        last = mix_shadow.frame;
+        last_answer = mix_shadow.answer;
+        time = mix_shadow.time;
+    } else if (cmd == BUS_ACT || bus_shadow_act(cmd) >= 0) {
+        last = act_shadow.frame;
+        last_answer = act_shadow.answer;
+        time = act_shadow.time;
+    } else {
+        return 0;
+    }
+    if (memcmp(last, frame, MSG_LEN) != 0 || time_now() - time >= refresh)
+        return 0;
+    memcpy(answer, last_answer, MSG_BUF);
+    return 1;
+}
+
+/**********************************************************
+ *  Function: bus_shadow_forget
+ *
+ *  Leaves the state of every actuator unknown.
+ *********************************************************/
+static void bus_shadow_forget()
+{
+    memset(act_shadow.state, '?', NUM_ACTS);
+    memset(act_shadow.frame, '\0', MSG_BUF);
+    mix_shadow.valid = 0;
+}
+
+/**********************************************************
+ *  Function: bus_shadow_update
+ *
+ *  Records the answer to the frame of cmd. An OK answer
+ *  makes the frame the state of its shadow; any other
+ *  leaves that state unknown. ERR SET hands every actuator
+ *  to the slave. Called with the bus locked.
+ *********************************************************/
+static void bus_shadow_update(int cmd, const char *frame, const char *answer)
+{
+    int ok = strncmp(answer + 3, ":  OK", 5) == 0;
+    int act = bus_shadow_act(cmd);
+    int i;
+
+    if (cmd == BUS_ERR_SET) {
+        bus_shadow_forget();
+        return;
+    }
+
+    if (cmd == BUS_MIX_SET || cmd == BUS_MIX_CLR) {
+        mix_shadow.valid = ok;
+        memcpy(mix_shadow.frame, frame, MSG_LEN);
+        memcpy(mix_shadow.answer, answer, MSG_BUF);
+        mix_shadow.time = time_now();
+        return;
+    }
+    if (cmd != BUS_ACT && act < 0)
+        return;
+    if (!ok) {
+        memset(act_shadow.state, '?', NUM_ACTS);
+        memset(act_shadow.frame, '\0', MSG_BUF);
+        return;
+    }
+
+    if (act >= 0)
+        act_shadow.state[act] = cmd == act_cmds[act][BUS_ACT_SET] ? '1' : '0';
+    else
+        for (i = 0; i < NUM_ACTS; i++)
+            if (frame[5 + i] == '0' || frame[5 + i] == '1')
+                act_shadow.state[i] = frame[5 + i];
+    memcpy(act_shadow.frame, frame, MSG_LEN);
+    memcpy(act_shadow.answer, answer, MSG_BUF);
+    act_shadow.time = time_now();
+}
+
+#ifdef RASPBERRYPI
+/**********************************************************
+ *  Function: bus_stale
+ *
+ *  Whether answer is left from an earlier request than
+ *  frame: a queuing slave keeps the answer of a request
+ *  the master gave up polling, and it comes before the
+ *  next one. Every answer starts like its request or is
+ *  an error.
+ *********************************************************/
+static int bus_stale(const char *frame, const char *answer)
+{
+    if (!(caps & BUS_CAP_PIPELINE))
+        return 0;
+    return strncmp(answer, frame, 3) != 0 &&
+           strncmp(answer, "MSG: ERR", MSG_LEN) != 0;
+}
+
+/**********************************************************
+ *  Function: bus_read_answer
+ *
+ *  Reads the len bytes of the answer to frame, polling
+ *  while the slave says it is busy if it can, and skips
+ *  the stale answers before it. Returns the reads made.
+ *********************************************************/
+static unsigned long bus_read_answer(const char *frame, char *answer, int len)
+{
+    unsigned long polls = 0;
+    int stale = 0;
+
+    if (caps & BUS_CAP_READY_POLL) {
+        // read as soon as the slave has the answer ready
+        nsec_t wait = POLL_FIRST_NS;
+        nsec_t waited = wait;
+        time_sleep(wait);
+        while (1) {
+            read(fd_i2c, answer, len);
+            polls++;
+            if (strncmp(answer, "MSG:BUSY", MSG_LEN) == 0) {
+                if (waited >= time_msg)
+                    break;
+                // bounded exponential backoff
+                wait *= 2;
+                if (wait > POLL_MAX_NS)
+                    wait = POLL_MAX_NS;
+                time_sleep(wait);
+                waited += wait;
+            } else if (bus_stale(frame, answer) && stale++ < BUS_PIPE_DEPTH) {
+                continue;
+            } else {
+                break;
+            }
+        }
+    } else {
+        time_sleep(time_msg);
+        read(fd_i2c, answer, len);
+        polls = 1;
+    }
+    answer[len] = '\n';
+    return polls;
+}
+#endif
+
+/**********************************************************
+ *  Function: bus_exchange
+ *
+ *  Sends frame_len bytes of frame, accounted as cmd, and
+ *  stores the len bytes of its answer followed by '\n' and
+ *  '\0'. An actuator frame the slave already acknowledged
+ *  gets the answer it gave then, with no exchange.
+ *********************************************************/
+static int bus_exchange(int cmd, const char *frame, int frame_len,
+                        char *answer, int len)
+{
+    nsec_t start, latency;
+    unsigned long polls = 0;
+
+    memset(answer, '\0', len+2);
+    pthread_mutex_lock(&bus_lock);
+    if (bus_shadow_hit(cmd, frame, answer)) {
+        stats[cmd].cached++;
+        pthread_mutex_unlock(&bus_lock);
+        return BUS_OK;
+    }
+    start = time_now();
+
+#ifdef RASPBERRYPI
+    // use Raspberry Pi I2C serial module
+    write(fd_i2c, frame, frame_len);
+    if (cmd == BUS_REG_READ) {
+        // the registers are answered from the interrupt
+        read(fd_i2c, answer, len);
+        answer[len] = '\n';
+        polls = 1;
+    } else {
+        polls = bus_read_answer(frame, answer, len);
+    }
+#else
+    //Use the simulator
+    char request[MSG_BUF];
+    memset(request, '\0', MSG_BUF);
+    memcpy(request, frame, frame_len);
+    request[frame_len] = '\n';
+    simulator(request, answer);
+#endif
+
+    // Update the latency counters of the command
+    latency = time_now() - start;
+    histo_add(&stats[cmd].latency, latency);
+    stats[cmd].polls += polls;
+    trace_add(cmd, frame, frame_len, answer, len, start, latency);
+    bus_shadow_update(cmd, frame, answer);
+    pthread_mutex_unlock(&bus_lock);
+
+    // An empty answer means the slave is not responding
+    if (answer[0] == '\0')
+        return BUS_EMPTY;
+    return BUS_OK;
+}
+
+/**********************************************************
+ *  Function: bus_transfer
+ *
+ *  Sends the frame of cmd and stores the answer (MSG_LEN
+ *  chars, or MSG_LONG_LEN for BUS_SNS_REQ, plus '\n' and
+ *  '\0') in answer, which must hold MSG_BUF (MSG_LONG_BUF)
+ *  chars. Returns BUS_EMPTY if the slave did not answer
+ *  anything, BUS_OK otherwise.
+ *********************************************************/
+int bus_transfer(int cmd, char *answer)
+{
+    return bus_exchange(cmd, bus_frames[cmd], MSG_LEN, answer,
+                        bus_answer_len[cmd]);
+}
+
+/**********************************************************
+ *  Function: bus_act_hit
+ *
+ *  Whether the frames of the actuators in values would
+ *  leave the slave as it is: each one already shows its
+ *  value and last, the frame sent last, is the one the
+ *  slave acknowledged last, so the acceleration it writes
+ *  is the same too. Called with the bus locked.
+ *********************************************************/
+static int bus_act_hit(const int *values, int last)
+{
+    int i;
+
+    for (i = 0; i < NUM_ACTS; i++)
+        if (values[i] != BUS_ACT_KEEP &&
+            act_shadow.state[i] != '0' + values[i])
+            return 0;
+    return memcmp(act_shadow.frame, bus_frames[last], MSG_LEN) == 0 &&
+           time_now() - act_shadow.time < refresh;
+}
+
+/**********************************************************
+ *  Function: bus_transfer_act
+ *
+ *  Sets the accelerator, the brake and the lamps with a
+ *  single ACT frame. Each value is BUS_ACT_SET, BUS_ACT_CLR
+ *  or BUS_ACT_KEEP. A slave without BUS_CAP_COMPOUND gets
+ *  the LAM, GAS and BRK frames of the values in the order
+ *  ACT runs them (the lamps, the clears, the sets), so the
+ *  acceleration the slave is left with is the same, or
+ *  none if they would leave it as it is. The answer is
+ *  then the first that is not OK, or "ACT:  OK".
+ *********************************************************/
+int bus_transfer_act(int gas, int brk, int lam, char *answer)
+{
+    static const char chars[] = {'0', '1', '-'};
+    int values[NUM_ACTS] = {gas, brk, lam};
+    int cmds[NUM_ACTS];
+    char frame[MSG_BUF];
+    int i, n = 0, hit = 0, ret;
+
+    if (caps & BUS_CAP_COMPOUND) {
+        memcpy(frame, bus_frames[BUS_ACT], MSG_BUF);
+        for (i = 0; i < NUM_ACTS; i++)
+            frame[5 + i] = chars[values[i]];
+        return bus_exchange(BUS_ACT, frame, MSG_LEN, answer,
+                            bus_answer_len[BUS_ACT]);
+    }
+
+    if (lam != BUS_ACT_KEEP)
+        cmds[n++] = act_cmds[ACT_LAM][lam];
+    for (i = ACT_GAS; i <= ACT_BRK; i++)
+        if (values[i] == BUS_ACT_CLR)
+            cmds[n++] = act_cmds[i][BUS_ACT_CLR];
+    for (i = ACT_GAS; i <= ACT_BRK; i++)
+        if (values[i] == BUS_ACT_SET)
+            cmds[n++] = act_cmds[i][BUS_ACT_SET];
+
+    if (n > 0) {
+        pthread_mutex_lock(&bus_lock);
+        hit = bus_act_hit(values, cmds[n-1]);
+        if (hit)
+            stats[BUS_ACT].cached++;
+        pthread_mutex_unlock(&bus_lock);
+    }
+    for (i = 0; i < n && !hit; i++) {
+        ret = bus_transfer(cmds[i], answer);
+        if (strncmp(answer + 3, ":  OK", 5) != 0)
+            return ret;
+    }
+    memset(answer, '\0', MSG_BUF);
+    memcpy(answer, "ACT:  OK\n", MSG_LEN + 1);
+    return BUS_OK;
+}
+
+/**********************************************************
+ *  Function: bus_transfer_pipe
+ *
+ *  Sends the frames of the n commands in cmds (at most
+ *  BUS_PIPE_DEPTH, all with MSG_LEN answers) before
+ *  reading their answers, in the same order, into
+ *  answers. A slave without BUS_CAP_PIPELINE gets them one
+ *  at a time. The latency of each command runs from the
+ *  first write to its answer. Returns BUS_ERROR for a
+ *  command that cannot be queued, BUS_EMPTY if any answer
+ *  is empty, BUS_OK otherwise.
+ *********************************************************/
+int bus_transfer_pipe(const int *cmds, int n, char answers[][MSG_BUF])
+{
+    unsigned long polls = 0;
+    nsec_t start, latency;
+    int i, ret = BUS_OK;
+
+    if (n <= 0 || n > BUS_PIPE_DEPTH)
+        return BUS_ERROR;
+    for (i = 0; i < n; i++)
+        if (bus_answer_len[cmds[i]] != MSG_LEN)
+            return BUS_ERROR;
+
+    if (!(caps & BUS_CAP_PIPELINE)) {
+        for (i = 0; i < n; i++)
+            if (bus_transfer(cmds[i], answers[i]) == BUS_EMPTY)
+                ret = BUS_EMPTY;
+        return ret;
+    }
+
+    for (i = 0; i < n; i++)
+        memset(answers[i], '\0', MSG_BUF);
+    pthread_mutex_lock(&bus_lock);
+    start = time_now();
+
+#ifdef RASPBERRYPI
+    for (i = 0; i < n; i++)
+        write(fd_i2c, bus_frames[cmds[i]], MSG_LEN);
+#elif defined(HOST_SIM)
+    for (i = 0; i < n; i++)
+        simulator_send(bus_frames[cmds[i]]);
+#endif
+    for (i = 0; i < n; i++) {
+#ifdef RASPBERRYPI
+        polls = bus_read_answer(bus_frames[cmds[i]], answers[i], MSG_LEN);
+#elif defined(HOST_SIM)
+        simulator_receive(answers[i]);
+#endif
+        latency = time_now() - start;
+        histo_add(&stats[cmds[i]].latency, latency);
+        stats[cmds[i]].polls += polls;
+        trace_add(cmds[i], bus_frames[cmds[i]], MSG_LEN, answers[i], MSG_LEN,
+                  start, latency);
+        bus_shadow_update(cmds[i], bus_frames[cmds[i]], answers[i]);
+        if (answers[i][0] == '\0')
+            ret = BUS_EMPTY;
+    }
+    pthread_mutex_unlock(&bus_lock);
+    return ret;
+}
+
+/**********************************************************
+ *  Function: bus_reg_get
+ *
+ *  Signed little-endian value of size bytes at reg.
+ *********************************************************/
+static long bus_reg_get(const unsigned char *reg, int size)
+{
+    unsigned long value = 0;
+    int i;
+
+    for (i = size - 1; i >= 0; i--)
+        value = (value << 8) | reg[i];
+    if (size < (int)sizeof(long) && (reg[size-1] & 0x80))
+        value |= ~0UL << (8 * size);
+    return (long)value;
+}
+
+/**********************************************************
+ *  Function: bus_read_regs
+ *
+ *  Burst-reads the count bytes of the register map that
+ *  start at offset first and decodes into regs the
+ *  registers they hold whole; the other fields are left
+ *  as they were. Returns BUS_EMPTY if the slave did not
+ *  answer, BUS_ERROR if the answer does not start with the
+ *  select byte, BUS_OK otherwise.
+ *********************************************************/
+int bus_read_regs(int first, int count, struct bus_regs *regs)
+{
+    unsigned char answer[BUS_REG_SIZE + 3];
+    const unsigned char *map;
+    char select;
+    int ret;
+
+    if (first < 0 || count <= 0 || first + count > BUS_REG_SIZE)
+        return BUS_ERROR;
+    select = (char)(BUS_REG_SELECT | first);
+    ret = bus_exchange(BUS_REG_READ, &select, 1, (char *)answer, count + 1);
+    if (ret != BUS_OK)
+        return ret;
+    if (answer[0] != (unsigned char)select)
+        return BUS_ERROR;
+
+    // map[r] is register offset r, for first <= r < first + count
+    map = answer + 1 - first;
+#define BUS_REG_IN(reg, size) \
+    ((reg) >= first && (reg) + (size) <= first + count)
+    if (BUS_REG_IN(BUS_REG_SPEED, 2))
+        regs->speed = bus_reg_get(map + BUS_REG_SPEED, 2) / 100.0f;
+    if (BUS_REG_IN(BUS_REG_ACCEL, 2))
+        regs->accel = bus_reg_get(map + BUS_REG_ACCEL, 2) / 1000.0f;
+    if (BUS_REG_IN(BUS_REG_SLOPE, 1))
+        regs->slope = map[BUS_REG_SLOPE];
+    if (BUS_REG_IN(BUS_REG_LIGHT, 1))
+        regs->light = map[BUS_REG_LIGHT];
+    if (BUS_REG_IN(BUS_REG_DISTANCE, 4))
+        regs->distance = bus_reg_get(map + BUS_REG_DISTANCE, 4) / 1000.0;
+    if (BUS_REG_IN(BUS_REG_MODE, 1))
+        regs->mode = map[BUS_REG_MODE];
+    if (BUS_REG_IN(BUS_REG_FLAGS, 1))
+        regs->flags = map[BUS_REG_FLAGS];
+#undef BUS_REG_IN
+    return BUS_OK;
+}
+
+/**********************************************************
+ *  Function: bus_probe_caps
+ *
+ *  Asks the slave for the optional commands it supports.
+ *  Slaves that do not know CAP answer an error, so they
+ *  keep the plain 8-byte commands. BUS_CAP_PIPELINE is
+ *  dropped on a transport that cannot queue.
+ *********************************************************/
+int bus_probe_caps()
+{
+    char answer[MSG_BUF];
+    unsigned int value;
+
+    caps = 0;
+    bus_transfer(BUS_CAP_REQ, answer);
+    if (1 == sscanf(answer, "CAP:%4x\n", &value))
+        caps = value;
+    if (!BUS_QUEUES)
+        caps &= ~BUS_CAP_PIPELINE;
+    return caps;
+}
+
+/**********************************************************
+ *  Function: bus_get_caps
+ *********************************************************/
+int bus_get_caps()
+{
+    return caps;
+}
+
+/**********************************************************
+ *  Function: bus_cmd_name
+ *********************************************************/
+const char *bus_cmd_name(int cmd)
+{
+    static char name[MSG_LEN+1];
+    memcpy(name, bus_frames[cmd], MSG_LEN);
+    name[MSG_LEN] = '\0';
+    return name;
+}
+
+/**********************************************************
+ *  Function: bus_get_stats
+ *********************************************************/
+const struct bus_stats *bus_get_stats(int cmd)
+{
+    return &stats[cmd];
+}
+
+/**********************************************************
+ *  Function: bus_print_stats
+ *********************************************************/
+void bus_print_stats()
+{
+    int i;
+    pthread_mutex_lock(&bus_lock);
+    printf("BUS     count   min(us)  mean(us)   p99(us)   max(us)  polls "
+           "cached\n");
+    for (i = 0; i < BUS_NUM_CMDS; i++) {
+        const struct histo *h = &stats[i].latency;
+        if (h->count == 0 && stats[i].cached == 0)
+            continue;
+        printf("%s %6lu %9lld %9lld %9lld %9lld %6.1f %6lu\n", bus_cmd_name(i),
+               h->count, (long long)(h->min / 1000),
+               (long long)(histo_mean(h) / 1000),
+               (long long)(histo_percentile(h, 99) / 1000),
+               (long long)(h->max / 1000),
+               h->count ? (double)stats[i].polls / h->count : 0.0,
+               stats[i].cached);
+    }
+    pthread_mutex_unlock(&bus_lock);
+}
@@ -0,0 +1,148 @@
+/**********************************************************
+ *  bus.h
+ *
+ *  Single I2C transaction layer shared by the main
+ *  controllers (A-D). Every request frame is pre-built in
+ *  a static table and sent through bus_transfer(), which is
+ *  the only place that talks to the I2C driver (or to the
+ *  simulator) and the only place where timing is tuned.
+ *
+ *  Slaves that advertise BUS_CAP_REGISTERS also expose
+ *  their state as a binary register map: the master
+ *  writes one select byte and burst-reads the registers
+ *  from there on, fixed-point and little-endian, without
+ *  any formatting or parsing on either side.
+ *
+ *  Slaves that advertise BUS_CAP_PIPELINE queue up to
+ *  BUS_PIPE_DEPTH requests and answer them in order, so
+ *  bus_transfer_pipe() writes several commands before
+ *  reading any answer and they all run in the same pass
+ *  of the slave loop.
+ *
+ *  Actuator commands go through a shadow of the last
+ *  state the slave acknowledged: a command that would set
+ *  the same state again is answered from the shadow, until
+ *  the refresh interval (bus_set_refresh) has passed. The
+ *  gas, brake and lamps of bus_transfer_act() are compared
+ *  together, so a slave without ACT only gets their frames
+ *  when one of them changes.
+ *********************************************************/
+#ifndef BUS_H
+#define BUS_H
+
+#include "histo.h"
+#include "timing.h"
+
+//#define RASPBERRYPI
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define MSG_LEN    8
+#define MSG_BUF    10
+#define MSG_LONG_LEN 16
+#define MSG_LONG_BUF 18
+#define SLAVE_ADDR 0x8
+
+// Request frames (index into the static frame table)
+#define BUS_SPD_REQ 0
+#define BUS_SLP_REQ 1
+#define BUS_GAS_SET 2
+#define BUS_GAS_CLR 3
+#define BUS_BRK_SET 4
+#define BUS_BRK_CLR 5
+#define BUS_MIX_SET 6
+#define BUS_MIX_CLR 7
+#define BUS_LIT_REQ 8
+#define BUS_LAM_SET 9
+#define BUS_LAM_CLR 10
+#define BUS_STP_REQ 11
+#define BUS_DS_REQ  12
+#define BUS_ERR_SET 13
+#define BUS_CAP_REQ 14
+#define BUS_SNS_REQ 15  // compound SPD+SLP+LIT+DS, long answer
+#define BUS_ACT     16  // compound GAS+BRK+LAM, see bus_transfer_act
+#define BUS_REG_READ 17 // register burst read, see bus_read_regs
+#define BUS_NUM_CMDS 18
+
+// Capabilities advertised by the slave in the CAP answer
+#define BUS_CAP_COMPOUND 0x0001
+#define BUS_CAP_READY_POLL 0x0002  // "MSG:BUSY" until the answer is ready
+#define BUS_CAP_REGISTERS  0x0004  // binary register map
+#define BUS_CAP_PIPELINE   0x0008  // queued requests, see bus_transfer_pipe
+
+// Requests a pipelining slave queues
+#define BUS_PIPE_DEPTH 4
+
+// Age at which an acknowledged actuator state is sent again
+#define BUS_REFRESH_NS (20 * NS_PER_S)
+
+// Register map: offset of each register and its encoding
+#define BUS_REG_SPEED    0   // int16, speed in 0.01 m/s
+#define BUS_REG_ACCEL    2   // int16, acceleration in 0.001 m/s2
+#define BUS_REG_SLOPE    4   // uint8, BUS_SLOPE_*
+#define BUS_REG_LIGHT    5   // uint8, light in %
+#define BUS_REG_DISTANCE 6   // int32, distance to the stop in mm
+#define BUS_REG_MODE     10  // uint8, mode of the slave
+#define BUS_REG_FLAGS    11  // uint8, BUS_FLAG_*
+#define BUS_REG_SIZE     12
+// The select byte and the first byte of the answer
+#define BUS_REG_SELECT   0x80  // | offset of the first register
+
+#define BUS_SLOPE_FLAT 0
+#define BUS_SLOPE_UP   1
+#define BUS_SLOPE_DOWN 2
+#define BUS_SLOPE_NONE 3  // both switches on
+
+#define BUS_FLAG_GAS 0x01
+#define BUS_FLAG_BRK 0x02
+#define BUS_FLAG_MIX 0x04
+#define BUS_FLAG_LAM 0x08
+
+// Actuator values of bus_transfer_act
+#define BUS_ACT_CLR  0
+#define BUS_ACT_SET  1
+#define BUS_ACT_KEEP 2
+
+// Return values of bus_transfer
+#define BUS_OK     0
+#define BUS_EMPTY  1
+#define BUS_ERROR  2  // the answer is not the expected one
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct bus_stats {
+    struct histo latency;
+    unsigned long polls;
+    unsigned long cached;  // answered from the actuator shadow
+};
+
+// Decoded register map, in SI units
+struct bus_regs {
+    float speed;
+    float accel;
+    int slope;
+    int light;
+    double distance;
+    int mode;
+    int flags;
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+void bus_init();
+void bus_set_msg_delay(nsec_t delay);
+void bus_set_refresh(nsec_t refresh);
+int bus_probe_caps();
+int bus_get_caps();
+int bus_transfer(int cmd, char *answer);
+int bus_transfer_act(int gas, int brk, int lam, char *answer);
+int bus_read_regs(int first, int count, struct bus_regs *regs);
+int bus_transfer_pipe(const int *cmds, int n, char answers[][MSG_BUF]);
+const char *bus_cmd_name(int cmd);
+const struct bus_stats *bus_get_stats(int cmd);
+void bus_print_stats();
+
+#endif
@@ -14,89 +14,39 @@
 #include <rtems.h>
 #include <bsp.h>
 
-//#define RASPBERRYPI
-
-#ifdef RASPBERRYPI
-#include <bsp/i2c.h>
-#endif
-
+#include "bus.h"
+#include "timing.h"
+#include "trace.h"
 #include "displayA.h"
 
 /**********************************************************
  *  Constants
  **********************************************************/
-#define MSG_LEN    8
-#define SLAVE_ADDR 0x8
 #define TIME_CYCLE_SEC 10
-#define TIME_CYCLE_NSEC 10000000000
-#define NS_PER_S  1000000000
+#define OVERRUN_POLICY OVERRUN_SKIP
 
 /**********************************************************
  *  Global Variables
  *********************************************************/
 float speed = 0.0;
-struct timespec time_msg = {0,400000000};
-int fd_i2c = -1;
 
-struct timespec time_last_change_mixer;
+nsec_t time_last_change_mixer;
 int mixer_state;
 
-/**********************************************************
- *  Function: difftime
- *********************************************************/
-void diffT(struct timespec end,
-              struct timespec start,
-              struct timespec *diff)
-{
-    if (end.tv_nsec < start.tv_nsec) {
-        diff->tv_nsec = NS_PER_S - start.tv_nsec + end.tv_nsec;
-        diff->tv_sec = end.tv_sec - (start.tv_sec+1);
-    } else {
-        diff->tv_nsec = end.tv_nsec - start.tv_nsec;
-        diff->tv_sec = end.tv_sec - start.tv_sec;
-    }
-}
-
-/**********************************************************
- *  Function: addtime
- *********************************************************/
-void addT(struct timespec end,
-             struct timespec start,
-             struct timespec *add)
-{
-    unsigned long aux;
-    aux = start.tv_nsec + end.tv_nsec;
-    add->tv_sec = start.tv_sec + end.tv_sec +
-    (aux / NS_PER_S);
-    add->tv_nsec = aux % NS_PER_S;
-}
+// Gas and brake chosen in the cycle, sent together by
+// task_actuators
+int act_gas = BUS_ACT_KEEP;
+int act_brk = BUS_ACT_KEEP;
 
 /**********************************************************
  *  Function: task_speed
  *********************************************************/
 int task_speed()
 {
-    char request[10];
-    char answer[10];
-
-
-    //clear request and answer
-    memset(request, '\0', 10);
-    memset(answer, '\0', 10);
+    char answer[MSG_BUF];
 
     // request speed
-    strcpy(request, "SPD: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_SPD_REQ, answer);
 
     // display speed
     if (1 == sscanf (answer, "SPD:%f\n", &speed)){
@@ -110,26 +60,10 @@ int task_speed()
 //-------------------------------------
 int task_slope()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    char answer[MSG_BUF];
 
     // request slope
-    strcpy(request, "SLP: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_SLP_REQ, answer);
   // display slope
   if (0 == strcmp(answer, "SLP:DOWN\n")) displaySlope(-1);
   else if (0 == strcmp(answer, "SLP:FLAT\n")) displaySlope(0);
@@ -145,35 +79,17 @@ int task_slope()
 //-------------------------------------
 int task_acc()
 {
-    char request[10];
-    char answer[10];
-
-    // Clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
-
     // Request to accelerate
     if(speed <= 55.0){
-        strcpy(request, "GAS: SET\n");
+        act_gas = BUS_ACT_SET;
         displayGas(1);
     }
     else{
-        strcpy(request, "GAS: CLR\n");
+        act_gas = BUS_ACT_CLR;
         displayGas(0);
     }
 
-#ifdef RASPBERRYPI
-    // Use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    // Use the simulator
-    simulator(request, answer);
-#endif
-
-    return strcmp(answer, "GAS:  OK\n");
+    return 0;
 }
 
 //-------------------------------------
@@ -181,35 +97,33 @@ int task_acc()
 //-------------------------------------
 int task_brake()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
-
     // Request to brake
     if(speed <= 55.0){
-        strcpy(request, "BRK: CLR\n");
+        act_brk = BUS_ACT_CLR;
         displayBrake(0);
     }
     else{
-        strcpy(request, "BRK: SET\n");
+        act_brk = BUS_ACT_SET;
         displayBrake(1);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-
-    return strcmp(answer, "BRK:  OK\n");
+    return 0;
+}
+
+//-------------------------------------
+//-  Function: task_actuators
+//-------------------------------------
+int task_actuators()
+{
+    char answer[MSG_BUF];
+
+    // One ACT frame, or the GAS and BRK frames unless they
+    // change nothing on the slave
+    bus_transfer_act(act_gas, act_brk, BUS_ACT_KEEP, answer);
+    act_gas = BUS_ACT_KEEP;
+    act_brk = BUS_ACT_KEEP;
+
+    return strcmp(answer, "ACT:  OK\n");
 }
 
 //-------------------------------------
@@ -217,38 +131,26 @@ int task_brake()
 //-------------------------------------
 int task_mixer()
 {
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
+    int cmd;
 
   // Compute the time when the mixer needs to send the request to the arduino
-    struct timespec current, lapse;
-  	clock_gettime(CLOCK_REALTIME, &current);
-	diffT(current, time_last_change_mixer, &lapse);
-	if(lapse.tv_sec > 30) {
-		if(mixer_state) {
-			strcpy(request, "MIX: CLR\n");
-			mixer_state = 0;
-		} else {
-			strcpy(request, "MIX: SET\n");
-			mixer_state = 1;
-		}
-  }
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    nsec_t current = time_now();
+	if((current - time_last_change_mixer) / NS_PER_S <= 30)
+		return 0;
+	if(mixer_state) {
+		cmd = BUS_MIX_CLR;
+		mixer_state = 0;
+	} else {
+		cmd = BUS_MIX_SET;
+		mixer_state = 1;
+	}
+    bus_transfer(cmd, answer);
     // Check the Answer
     if(0 == strcmp(answer, "MIX:  OK\n")){
         displayMix(mixer_state);
         // Update the Mixer Time to change in the next 30 seconds
-        time_last_change_mixer.tv_nsec = current.tv_nsec;
-        time_last_change_mixer.tv_sec = current.tv_sec;
+        time_last_change_mixer = current;
         return 0;
     }
     // Error
@@ -265,13 +167,9 @@ int task_mixer()
 void *controller(void *arg)
 {
     mixer_state = 0;
-    clock_gettime( CLOCK_REALTIME, &time_last_change_mixer);
-    struct timespec start, end, diff, period;
-    period.tv_sec = (time_t) TIME_CYCLE_SEC;
-    period.tv_nsec = (long) 0;
-    if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-        printf("Error obtaining Strating Time\n");
-    }
+    time_last_change_mixer = time_now();
+    struct periodic loop;
+    periodic_init(&loop, "main", TIME_CYCLE_SEC * NS_PER_S, OVERRUN_POLICY);
     // Endless loop: In 1 secondaryCycle we execute all tasks:
     while(1) {
 
@@ -282,26 +180,18 @@ void *controller(void *arg)
       if(task_speed() != 0)
           printf("Error when reading speed\n");
       // calling task of gas
-      if(task_acc() != 0)
-          printf("Error when reading gas\n");
+      task_acc();
       // calling task of brake
-      if(task_brake() != 0)
-          printf("Error when reading brake\n");
+      task_brake();
+      // sending gas and brake
+      if(task_actuators() != 0)
+          printf("Error when setting gas and brake\n");
       // calling task of mixer
       if(task_mixer() != 0)
           printf("Error when reading mixer\n");
 
-    //Get end of main cycle
-    if( clock_gettime( CLOCK_REALTIME, &end) == -1 ) {
-      printf("Error obtaining ending time\n");
-    }
-
-    // Sleep the neccesary time until makes the next iteration
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
+    // Sleep until the absolute release of the next iteration
+    periodic_wait(&loop);
 
     }
 }
@@ -328,20 +218,10 @@ rtems_task Init (rtems_task_argument ignored)
     // init display
     displayInit(SIGRTMAX);
 
-#ifdef RASPBERRYPI
-    // Init the i2C driver
-    rpi_i2c_init();
-
-    // bus registering, this init the ports needed for the conexion
-    // and register the device under /dev/i2c
-    rpi_i2c_register_bus("/dev/i2c", 10000);
-
-    // open device file
-    fd_i2c = open("/dev/i2c", O_RDWR);
-
-    // register the address of the slave to comunicate with
-    ioctl(fd_i2c, I2C_SLAVE, SLAVE_ADDR);
-#endif
+    // init the I2C bus (or the simulator)
+    bus_init();
+    if (trace_start() != 0)
+        exit(1);
 
     /* Create first thread */
     pthread_create(&thread_ctrl, NULL, controller, NULL);
@@ -357,7 +237,10 @@ rtems_task Init (rtems_task_argument ignored)
 #define CONFIGURE_MAXIMUM_SEMAPHORES 10
 #define CONFIGURE_MAXIMUM_FILE_DESCRIPTORS 30
 #define CONFIGURE_MAXIMUM_DIRVER 10
-#define CONFIGURE_MAXIMUM_POSIX_THREADS 2
+// controller and trace flusher; bus and trace mutexes
+#define CONFIGURE_MAXIMUM_POSIX_THREADS 3
+#define CONFIGURE_MAXIMUM_POSIX_MUTEXES 2
+#define CONFIGURE_MAXIMUM_POSIX_SEMAPHORES 1
 #define CONFIGURE_MAXIMUM_POSIX_TIMERS 1
 
 #define CONFIGURE_INIT
@@ -13,21 +13,16 @@
 #include <rtems.h>
 #include <bsp.h>
 
-//#define RASPBERRYPI
-#ifdef RASPBERRYPI
-#include <bsp/i2c.h>
-#endif
-
+#include "bus.h"
+#include "timing.h"
+#include "trace.h"
 #include "displayC.h"
 
 /**********************************************************
  *  Constants
  **********************************************************/
-#define MSG_LEN    8
-#define SLAVE_ADDR 0x8
 #define TIME_CYCLE_SEC 5
-#define TIME_CYCLE_NSEC 5000000000
-#define NS_PER_S  1000000000
+#define OVERRUN_POLICY OVERRUN_SKIP
 
 #define NORMAL_MODE 0
 #define BRAKING_MODE 1
@@ -37,69 +32,28 @@
  *  Global Variables
  *********************************************************/
 float speed = 0.0;
-struct timespec time_msg = {0,400000000};
-int fd_i2c = -1;
 int dark = 0;
 int mixer_state = 0;
-struct timespec time_last_change_mixer;
+nsec_t time_last_change_mixer;
+
+// Gas, brake and lamps chosen in the secondary cycle, sent
+// together by task_actuators
+int act_gas = BUS_ACT_KEEP;
+int act_brk = BUS_ACT_KEEP;
+int act_lam = BUS_ACT_KEEP;
+// Release grid of the secondary cycles, kept across mode changes
+struct periodic loop;
 unsigned int current_distance;
 
-/**********************************************************
- *  Function: difftime
- *********************************************************/
-void diffT(struct timespec end,
-              struct timespec start,
-              struct timespec *diff)
-{
-    if (end.tv_nsec < start.tv_nsec) {
-        diff->tv_nsec = NS_PER_S - start.tv_nsec + end.tv_nsec;
-        diff->tv_sec = end.tv_sec - (start.tv_sec+1);
-    } else {
-        diff->tv_nsec = end.tv_nsec - start.tv_nsec;
-        diff->tv_sec = end.tv_sec - start.tv_sec;
-    }
-}
-
-/**********************************************************
- *  Function: addtime
- *********************************************************/
-void addT(struct timespec end,
-             struct timespec start,
-             struct timespec *add)
-{
-    unsigned long aux;
-    aux = start.tv_nsec + end.tv_nsec;
-    add->tv_sec = start.tv_sec + end.tv_sec +
-    (aux / NS_PER_S);
-    add->tv_nsec = aux % NS_PER_S;
-}
-
-
 /**********************************************************
  *  Function: task_speed
  *********************************************************/
 int task_speed()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request, '\0', 10);
-    memset(answer, '\0', 10);
+    char answer[MSG_BUF];
 
     // request speed
-    strcpy(request, "SPD: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_SPD_REQ, answer);
 
     // display speed
     if (1 == sscanf (answer, "SPD:%f\n", &speed)){
@@ -113,26 +67,10 @@ int task_speed()
 //-------------------------------------
 int task_slope()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    char answer[MSG_BUF];
 
     // request slope
-    strcpy(request, "SLP: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_SLP_REQ, answer);
   if (0 == strcmp(answer, "SLP:DOWN\n")) displaySlope(-1);
   else if (0 == strcmp(answer, "SLP:FLAT\n")) displaySlope(0);
   else if (0 == strcmp(answer, "SLP:  UP\n")) displaySlope(1);
@@ -148,36 +86,17 @@ return 0;
 //-------------------------------------
 int task_acc()
 {
-    char request[10];
-    char answer[10];
-
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
-
     // Request to accelerate
     if(speed <= 55.0){
-        strcpy(request, "GAS: SET\n");
+        act_gas = BUS_ACT_SET;
         displayGas(1);
     }
     else{
-        strcpy(request, "GAS: CLR\n");
+        act_gas = BUS_ACT_CLR;
         displayGas(0);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-
-    return strcmp(answer, "GAS:  OK\n");
+    return 0;
 }
 
 //-------------------------------------
@@ -185,34 +104,17 @@ int task_acc()
 //-------------------------------------
 int task_acc_brake_mode()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
-
     // Request to accelerate in brake mode
     if(speed <= 2.5){
-        strcpy(request, "GAS: SET\n");
+        act_gas = BUS_ACT_SET;
         displayGas(1);
     }
     else{
-        strcpy(request, "GAS: CLR\n");
+        act_gas = BUS_ACT_CLR;
         displayGas(0);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    return strcmp(answer, "GAS:  OK\n");
+    return 0;
 }
 
 //-------------------------------------
@@ -220,35 +122,17 @@ int task_acc_brake_mode()
 //-------------------------------------
 int task_brake()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
-
     // Request to brake
     if(speed <= 55.0){
-        strcpy(request, "BRK: CLR\n");
+        act_brk = BUS_ACT_CLR;
         displayBrake(0);
     }
     else{
-        strcpy(request, "BRK: SET\n");
+        act_brk = BUS_ACT_SET;
         displayBrake(1);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-
-    return strcmp(answer, "BRK:  OK\n");
+    return 0;
 }
 
 //-------------------------------------
@@ -256,35 +140,17 @@ int task_brake()
 //-------------------------------------
 int task_brake_brake_mode()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
-
     // Request to brake in brake mode
     if(speed <= 2.5){
-        strcpy(request, "BRK: CLR\n");
+        act_brk = BUS_ACT_CLR;
         displayBrake(0);
     }
     else{
-        strcpy(request, "BRK: SET\n");
+        act_brk = BUS_ACT_SET;
         displayBrake(1);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-
-    return strcmp(answer, "BRK:  OK\n");
+    return 0;
 }
 
 
@@ -293,39 +159,27 @@ int task_brake_brake_mode()
 //-------------------------------------
 int task_mixer()
 {
-  char request[10];
-  char answer[10];
+  char answer[MSG_BUF];
+  int cmd;
 
 // Compute the time when the mixer needs to send the request to the arduino
-  struct timespec current, lapse;
-  clock_gettime(CLOCK_REALTIME, &current);
-  diffT(current, time_last_change_mixer, &lapse);
+  nsec_t current = time_now();
   // Wait 30 seconds until changes the state
-	if(lapse.tv_sec > 30) {
-		if(mixer_state) {
-			strcpy(request, "MIX: CLR\n");
-			mixer_state = 0;
-		} else {
-			strcpy(request, "MIX: SET\n");
-			mixer_state = 1;
-		}
-  }
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+	if((current - time_last_change_mixer) / NS_PER_S <= 30)
+		return 0;
+	if(mixer_state) {
+		cmd = BUS_MIX_CLR;
+		mixer_state = 0;
+	} else {
+		cmd = BUS_MIX_SET;
+		mixer_state = 1;
+	}
+    bus_transfer(cmd, answer);
   // Check the Answer
   if(0 == strcmp(answer, "MIX:  OK\n")){
       displayMix(mixer_state);
       // Update the Mixer Time to change in the next 30 seconds
-      time_last_change_mixer.tv_nsec = current.tv_nsec;
-      time_last_change_mixer.tv_sec = current.tv_sec;
+      time_last_change_mixer = current;
       return 0;
   }
   // Error
@@ -340,22 +194,10 @@ int task_mixer()
 //-------------------------------------
 int task_light_sensor()
 {
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
 
 	// Insert the request
-	strcpy(request, "LIT: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_LIT_REQ, answer);
     // Check
 	int light = 0;
 	if(sscanf(answer, "LIT:%d\n", &light) == 1) {
@@ -376,31 +218,15 @@ int task_light_sensor()
 //-------------------------------------
 int task_lights_turn()
 {
-  char request[10];
-  char answer[10];
-
     // Check is variable is dark or not
 	if(dark) {
-		strcpy(request, "LAM: SET\n");
+		act_lam = BUS_ACT_SET;
 	} else {
-		strcpy(request, "LAM: CLR\n");
+		act_lam = BUS_ACT_CLR;
 	}
 	displayLamps(dark);
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    if (strcmp(answer,"LAM:  OK\n")==0){
-    	return 1;
-    }
-	return -1;
+	return 0;
 }
 
 //-------------------------------------
@@ -408,51 +234,38 @@ int task_lights_turn()
 //-------------------------------------
 int task_lights_turn_brake_mode()
 {
-	char request[10];
-  char answer[10];
-
   // Turn On since it is in braking mode
-		strcpy(request, "LAM: SET\n");
 	displayLamps(1);
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-	return strcmp(answer,"LAM:  OK\n");
+	act_lam = BUS_ACT_SET;
+	return 0;
 }
 
 //-------------------------------------
-//-  Function: task_read_movement
+//-  Function: task_actuators
 //-------------------------------------
-int task_read_movement(){
-  char request[10];
-  char answer[10];
+int task_actuators()
+{
+    char answer[MSG_BUF];
 
+    // One ACT frame, or the GAS, BRK and LAM frames unless
+    // they change nothing on the slave
+    bus_transfer_act(act_gas, act_brk, act_lam, answer);
+    act_gas = BUS_ACT_KEEP;
+    act_brk = BUS_ACT_KEEP;
+    act_lam = BUS_ACT_KEEP;
 
-  //clear request and answer
-  memset(request,'\0',10);
-  memset(answer,'\0',10);
+    return strcmp(answer, "ACT:  OK\n");
+}
+
+//-------------------------------------
+//-  Function: task_read_movement
+//-------------------------------------
+int task_read_movement(){
+  char answer[MSG_BUF];
 
   // request movement
-  strcpy(request, "STP: REQ\n");
-
-#ifdef RASPBERRYPI
-  // use Raspberry Pi I2C serial module
-  write(fd_i2c, request, MSG_LEN);
-  nanosleep(&time_msg, NULL);
-  read(fd_i2c, answer, MSG_LEN);
-  answer[8] = '\n';
-#else
-  //Use the simulator
-  simulator(request, answer);
-#endif
+    bus_transfer(BUS_STP_REQ, answer);
   if(strcmp(answer, "STP:  GO\n") == 0){
     displayStop(0);
     return NORMAL_MODE;
@@ -475,26 +288,10 @@ int task_read_movement(){
 //-------------------------------------
 int task_distance(){
 
-  char request[10];
-  char answer[10];
-
-  //clear request and answer
-  memset(request,'\0',10);
-  memset(answer,'\0',10);
+  char answer[MSG_BUF];
 
   // request distance
-  strcpy(request, "DS:  REQ\n");
-
-  #ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-  #else
-    //Use the simulator
-    simulator(request, answer);
-  #endif
+    bus_transfer(BUS_DS_REQ, answer);
     if(sscanf(answer, "DS:%u\n", &current_distance) == 1){
       displayDistance(current_distance);
 
@@ -516,26 +313,10 @@ int task_distance(){
 //-------------------------------------
 int task_distance_brake_mode(){
 
-  char request[10];
-  char answer[10];
-
-  //clear request and answer
-  memset(request,'\0',10);
-  memset(answer,'\0',10);
+  char answer[MSG_BUF];
 
   // request distance in brake mode
-  strcpy(request, "DS:  REQ\n");
-
-  #ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-  #else
-    //Use the simulator
-    simulator(request, answer);
-  #endif
+    bus_transfer(BUS_DS_REQ, answer);
     if(sscanf(answer, "DS:%u\n", &current_distance) == 1){
       displayDistance(current_distance);
 
@@ -560,14 +341,8 @@ int task_distance_brake_mode(){
 int normal_execution(){
   int mode = NORMAL_MODE;
   int secondary_cycle = 0;
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) 0;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
-  }
-
   while (mode == NORMAL_MODE){
+    trace_context(mode, secondary_cycle);
     switch(secondary_cycle){
         case 0:
             task_slope();
@@ -585,14 +360,10 @@ int normal_execution(){
             task_lights_turn();
             break;
     }
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
+    task_actuators();
     secondary_cycle = (secondary_cycle+1) %2;
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
+    // Sleep until the absolute release of the next cycle
+    periodic_wait(&loop);
   }
 
   return mode;
@@ -605,14 +376,9 @@ int braking_execution(){
   int mode = BRAKING_MODE;
   int secondary_cycle = 0;
 
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) 0;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
-  }
 
   while (mode == BRAKING_MODE){
+    trace_context(mode, secondary_cycle);
     switch(secondary_cycle){
         case 0:
             task_speed();
@@ -656,14 +422,10 @@ int braking_execution(){
           break;
 
     }
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
+    task_actuators();
     secondary_cycle = (secondary_cycle+1) %6;
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
+    // Sleep until the absolute release of the next cycle
+    periodic_wait(&loop);
 
   }
   return mode;
@@ -675,24 +437,15 @@ int braking_execution(){
 int stop_execution(){
   int mode = STOP_MODE;
 
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) 0;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
-  }
   while (mode == STOP_MODE){
+    trace_context(mode, 0);
     mode = task_read_movement();
     task_mixer();
     task_lights_turn_brake_mode();
+    task_actuators();
 
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
+    // Sleep until the absolute release of the next cycle
+    periodic_wait(&loop);
   }
   return mode;
 
@@ -706,7 +459,9 @@ void *controller(void *arg)
 {
     int mode = 0;
     mixer_state = 0;
-    clock_gettime( CLOCK_REALTIME, &time_last_change_mixer);
+    time_last_change_mixer = time_now();
+    periodic_init(&loop, "secondary", TIME_CYCLE_SEC * NS_PER_S,
+                  OVERRUN_POLICY);
 
     // Endless loop
     while(1) {
@@ -721,6 +476,8 @@ void *controller(void *arg)
           mode = stop_execution();
           break;
       }
+      // Report the release jitter observed in the last mode
+      periodic_print(&loop);
     }
 }
 
@@ -746,20 +503,10 @@ rtems_task Init (rtems_task_argument ignored)
     // init display
     displayInit(SIGRTMAX);
 
-#ifdef RASPBERRYPI
-    // Init the i2C driver
-    rpi_i2c_init();
-
-    // bus registering, this init the ports needed for the conexion
-    // and register the device under /dev/i2c
-    rpi_i2c_register_bus("/dev/i2c", 10000);
-
-    // open device file
-    fd_i2c = open("/dev/i2c", O_RDWR);
-
-    // register the address of the slave to comunicate with
-    ioctl(fd_i2c, I2C_SLAVE, SLAVE_ADDR);
-#endif
+    // init the I2C bus (or the simulator)
+    bus_init();
+    if (trace_start() != 0)
+        exit(1);
 
     /* Create first thread */
     pthread_create(&thread_ctrl, NULL, controller, NULL);
@@ -775,7 +522,10 @@ rtems_task Init (rtems_task_argument ignored)
 #define CONFIGURE_MAXIMUM_SEMAPHORES 10
 #define CONFIGURE_MAXIMUM_FILE_DESCRIPTORS 30
 #define CONFIGURE_MAXIMUM_DIRVER 10
-#define CONFIGURE_MAXIMUM_POSIX_THREADS 2
+// controller and trace flusher; bus and trace mutexes
+#define CONFIGURE_MAXIMUM_POSIX_THREADS 3
+#define CONFIGURE_MAXIMUM_POSIX_MUTEXES 2
+#define CONFIGURE_MAXIMUM_POSIX_SEMAPHORES 1
 #define CONFIGURE_MAXIMUM_POSIX_TIMERS 1
 
 #define CONFIGURE_INIT
@@ -13,107 +13,157 @@
 #include <rtems.h>
 #include <bsp.h>
 
-//#define RASPBERRYPI
-#ifdef RASPBERRYPI
-#include <bsp/i2c.h>
-#endif
-
+#include "bus.h"
+#include "timing.h"
+#include "trace.h"
+#include "cyclic.h"
+#include "rm.h"
+#include "sensor.h"
 #include "displayD.h"
 
 /**********************************************************
  *  Constants
  **********************************************************/
-#define MSG_LEN    8
-#define SLAVE_ADDR 0x8
 #define TIME_CYCLE_SEC 5
-#define TIME_CYCLE_NSEC 5000000000
-#define NS_PER_S  1000000000
+#define OVERRUN_POLICY OVERRUN_SKIP
+
+// One preemptive thread per task (rm.h) instead of the cyclic executive
+//#define RM_THREADS
 
 #define NORMAL_MODE 0
 #define BRAKING_MODE 1
 #define STOP_MODE 2
 #define EMERGENCY_MODE 3
+#define NUM_MODES 4
+
+// Budget of a task with one bus exchange
+#define WCET_BUS_MS 450
+
+// Oldest sensor values a control decision takes; an older one is
+// read again first. Within a secondary cycle the table order reads
+// them before they are used, so only a delayed or reordered task
+// (RM_THREADS) polls again.
+#define SPEED_MAX_AGE_MS 2000
+// light_sensor is sheddable: the value it read in the frame that
+// missed must last the NORMAL major cycle (2 frames) it is shed for,
+// or lights_turn would poll it anyway
+#define DARK_MAX_AGE_MS (3 * TIME_CYCLE_SEC * 1000)
+
+// Period of the timing report, besides the one at every mode change
+#define STATS_DUMP_SEC 60
+
+// What a secondary cycle that misses its deadline does: nothing
+// (CYCLIC_REACT_NONE), drop the mixer and the light sensor for a major
+// cycle (CYCLIC_REACT_SHED) or go to EMERGENCY_MODE (CYCLIC_REACT_MODE)
+#define MISS_REACTION CYCLIC_REACT_SHED
 
 /**********************************************************
  *  Global Variables
  *********************************************************/
-float speed = 0.0;
-struct timespec time_msg = {0,400000000};
-int fd_i2c = -1;
-int dark = 0;
 int mixer_state = 0;
-struct timespec time_last_change_mixer;
-unsigned int current_distance;
+nsec_t time_last_change_mixer;
+// Release grid of the secondary cycles, kept across mode changes
+struct periodic loop;
+nsec_t time_last_dump;
 int emg_mode = 0;
-char error_string[10] = {'\0','\0','\0','\0','\0','\0','\0','\0','\n','\0'};
+
+// With RM_THREADS the tasks run in their own threads, so the state
+// above is only touched under state_lock (priority inheritance); the
+// sensor values are in the cache of sensor.h
+#ifdef RM_THREADS
+pthread_mutex_t state_lock;
+#define STATE_LOCK()   pthread_mutex_lock(&state_lock)
+#define STATE_UNLOCK() pthread_mutex_unlock(&state_lock)
+#else
+#define STATE_LOCK()
+#define STATE_UNLOCK()
+#endif
 
 /**********************************************************
- *  Function: difftime
+ *  Function: get_emg_mode
  *********************************************************/
-void diffT(struct timespec end,
-              struct timespec start,
-              struct timespec *diff)
+int get_emg_mode()
 {
-    if (end.tv_nsec < start.tv_nsec) {
-        diff->tv_nsec = NS_PER_S - start.tv_nsec + end.tv_nsec;
-        diff->tv_sec = end.tv_sec - (start.tv_sec+1);
-    } else {
-        diff->tv_nsec = end.tv_nsec - start.tv_nsec;
-        diff->tv_sec = end.tv_sec - start.tv_sec;
-    }
+    int value;
+    STATE_LOCK();
+    value = emg_mode;
+    STATE_UNLOCK();
+    return value;
 }
 
 /**********************************************************
- *  Function: addtime
+ *  Function: set_emg_mode
  *********************************************************/
-void addT(struct timespec end,
-             struct timespec start,
-             struct timespec *add)
+void set_emg_mode()
 {
-    unsigned long aux;
-    aux = start.tv_nsec + end.tv_nsec;
-    add->tv_sec = start.tv_sec + end.tv_sec +
-    (aux / NS_PER_S);
-    add->tv_nsec = aux % NS_PER_S;
+    STATE_LOCK();
+    emg_mode = 1;
+    STATE_UNLOCK();
 }
 
-
 /**********************************************************
- *  Function: task_speed
+ *  Function: refresh_speed
+ *
+ *  Reads the speed into the sensor cache. Returns
+ *  BUS_EMPTY, and goes to emergency, if the slave does not
+ *  answer.
  *********************************************************/
-int task_speed()
+int refresh_speed()
 {
-    if (emg_mode)
-      return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request, '\0', 10);
-    memset(answer, '\0', 10);
+    char answer[MSG_BUF];
+    float value;
 
     // request speed
-    strcpy(request, "SPD: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    if (bus_transfer(BUS_SPD_REQ, answer) == BUS_EMPTY){
+      set_emg_mode();
+      return BUS_EMPTY;
+    }
 
     // display speed
-    if (1 == sscanf (answer, "SPD:%f\n", &speed)){
-        displaySpeed(speed);
+    if (1 == sscanf (answer, "SPD:%f\n", &value)){
+        sensor_set(SENSOR_SPEED, value);
+        displaySpeed(value);
     }
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    return BUS_OK;
+}
+
+/**********************************************************
+ *  Function: get_speed
+ *
+ *  Stores in speed the speed acquired at most
+ *  SPEED_MAX_AGE_MS ago. Returns SENSOR_STALE if it could
+ *  not be refreshed, with the old speed stored.
+ *********************************************************/
+int get_speed(float *speed)
+{
+    struct sensor_sample sample;
+    int status = sensor_read(SENSOR_SPEED, SPEED_MAX_AGE_MS * NS_PER_MS,
+                             refresh_speed, &sample);
+    *speed = sample.value;
+    return status;
+}
+
+/**********************************************************
+ *  Function: sensor_stale
+ *
+ *  What a task returns instead of acting on a stale value:
+ *  emergency mode if the refresh found the bus empty, an
+ *  error otherwise, as for an answer it could not parse.
+ *********************************************************/
+int sensor_stale()
+{
+    return get_emg_mode() ? EMERGENCY_MODE : -1;
+}
+
+/**********************************************************
+ *  Function: task_speed
+ *********************************************************/
+int task_speed()
+{
+    if (get_emg_mode())
+      return EMERGENCY_MODE;
+    if (refresh_speed() == BUS_EMPTY)
       return EMERGENCY_MODE;
-    }
     return 0;
 }
 
@@ -122,31 +172,7 @@ int task_speed()
  *********************************************************/
 int task_speed_emg_mode()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request, '\0', 10);
-    memset(answer, '\0', 10);
-
-    // request speed
-    strcpy(request, "SPD: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-
-    // display speed
-    if (1 == sscanf (answer, "SPD:%f\n", &speed)){
-        displaySpeed(speed);
-    }
+    refresh_speed();
     return 0;
 }
 
@@ -155,35 +181,18 @@ int task_speed_emg_mode()
 //-------------------------------------
 int task_slope()
 {
-    if (emg_mode)
+    if (get_emg_mode())
       return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    char answer[MSG_BUF];
 
     // request slope
-    strcpy(request, "SLP: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    if (bus_transfer(BUS_SLP_REQ, answer) == BUS_EMPTY){
+      set_emg_mode();
+      return EMERGENCY_MODE;
+    }
   if (0 == strcmp(answer, "SLP:DOWN\n")) displaySlope(-1);
   else if (0 == strcmp(answer, "SLP:FLAT\n")) displaySlope(0);
   else if (0 == strcmp(answer, "SLP:  UP\n")) displaySlope(1);
-  if (strcmp(answer, error_string)==0){
-    emg_mode = 1;
-    return EMERGENCY_MODE;
-  }
 
   return 0;
 }
@@ -193,26 +202,10 @@ int task_slope()
 //-------------------------------------
 int task_slope_emg_mode()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    char answer[MSG_BUF];
 
     // request slope
-    strcpy(request, "SLP: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_SLP_REQ, answer);
   if (0 == strcmp(answer, "SLP:DOWN\n")) displaySlope(-1);
   else if (0 == strcmp(answer, "SLP:FLAT\n")) displaySlope(0);
   else if (0 == strcmp(answer, "SLP:  UP\n")) displaySlope(1);
@@ -225,37 +218,27 @@ int task_slope_emg_mode()
 //-------------------------------------
 int task_acc()
 {
-    if (emg_mode)
+    if (get_emg_mode())
       return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
+    int cmd;
+    float speed;
 
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    if (get_speed(&speed) != SENSOR_OK)
+      return sensor_stale();
 
     // Request to accelerate
     if(speed <= 55.0){
-        strcpy(request, "GAS: SET\n");
+        cmd = BUS_GAS_SET;
         displayGas(1);
     }
     else{
-        strcpy(request, "GAS: CLR\n");
+        cmd = BUS_GAS_CLR;
         displayGas(0);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(cmd, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
     return strcmp(answer, "GAS:  OK\n");
@@ -267,37 +250,27 @@ int task_acc()
 int task_acc_brake_mode()
 {
 
-    if (emg_mode)
+    if (get_emg_mode())
       return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
+    int cmd;
+    float speed;
 
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    if (get_speed(&speed) != SENSOR_OK)
+      return sensor_stale();
 
     // Request to accelerate in brake mode
     if(speed <= 2.5){
-        strcpy(request, "GAS: SET\n");
+        cmd = BUS_GAS_SET;
         displayGas(1);
     }
     else{
-        strcpy(request, "GAS: CLR\n");
+        cmd = BUS_GAS_CLR;
         displayGas(0);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(cmd, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
     return strcmp(answer, "GAS:  OK\n");
@@ -308,29 +281,13 @@ int task_acc_brake_mode()
 //-------------------------------------
 int task_acc_emg_mode()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    char answer[MSG_BUF];
 
     // Request to accelerate in emergency mode
-    strcpy(request, "GAS: CLR\n");
     displayGas(0);
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(BUS_GAS_CLR, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
     // Check The answer from arduino
@@ -342,37 +299,27 @@ int task_acc_emg_mode()
 //-------------------------------------
 int task_brake()
 {
-    if (emg_mode)
+    if (get_emg_mode())
       return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
+    int cmd;
+    float speed;
 
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    if (get_speed(&speed) != SENSOR_OK)
+      return sensor_stale();
 
     // Request to brake
     if(speed <= 55.0){
-        strcpy(request, "BRK: CLR\n");
+        cmd = BUS_BRK_CLR;
         displayBrake(0);
     }
     else{
-        strcpy(request, "BRK: SET\n");
+        cmd = BUS_BRK_SET;
         displayBrake(1);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(cmd, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
     return strcmp(answer, "BRK:  OK\n");
@@ -383,37 +330,27 @@ int task_brake()
 //-------------------------------------
 int task_brake_brake_mode()
 {
-    if (emg_mode)
+    if (get_emg_mode())
       return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
+    int cmd;
+    float speed;
 
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    if (get_speed(&speed) != SENSOR_OK)
+      return sensor_stale();
 
     // Request to brake in brake mode
     if(speed <= 2.5){
-        strcpy(request, "BRK: CLR\n");
+        cmd = BUS_BRK_CLR;
         displayBrake(0);
     }
     else{
-        strcpy(request, "BRK: SET\n");
+        cmd = BUS_BRK_SET;
         displayBrake(1);
     }
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(cmd, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
     return strcmp(answer, "BRK:  OK\n");
@@ -424,76 +361,69 @@ int task_brake_brake_mode()
 //-------------------------------------
 int task_brake_emg_mode()
 {
-    char request[10];
-    char answer[10];
-
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+    char answer[MSG_BUF];
 
     // Request to brake in emergency mode
-    strcpy(request, "BRK: SET\n");
     displayBrake(1);
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    bus_transfer(BUS_BRK_SET, answer);
     // Check the answer from arduino
     return strcmp(answer, "BRK:  OK\n");
 }
 
 
 //-------------------------------------
-//-  Function: task_mixer
+//-  Function: mixer_toggle
 //-------------------------------------
-int task_mixer()
+int mixer_toggle()
 {
-  if (emg_mode)
-    return EMERGENCY_MODE;
-  char request[10];
-  char answer[10];
+  char answer[MSG_BUF];
+  int cmd, state;
+  nsec_t last;
 
 // Compute the time when the mixer needs to send the request to the arduino
-  struct timespec current, lapse;
-  clock_gettime(CLOCK_REALTIME, &current);
-  diffT(current, time_last_change_mixer, &lapse);
+  nsec_t current = time_now();
   // Wait 30 seconds until changes the state
-	if(lapse.tv_sec > 30) {
-		if(mixer_state) {
-			strcpy(request, "MIX: CLR\n");
-			mixer_state = 0;
-		} else {
-			strcpy(request, "MIX: SET\n");
-			mixer_state = 1;
-		}
+  STATE_LOCK();
+  last = time_last_change_mixer;
+  if((current - last) / NS_PER_S <= 30){
+    STATE_UNLOCK();
+    return BUS_OK;
+  }
+  mixer_state = !mixer_state;
+  state = mixer_state;
+  // Claim the change so no other mixer task repeats it
+  time_last_change_mixer = current;
+  STATE_UNLOCK();
+
+  cmd = state ? BUS_MIX_SET : BUS_MIX_CLR;
+  if (bus_transfer(cmd, answer) == BUS_EMPTY){
+    STATE_LOCK();
+    time_last_change_mixer = last;
+    STATE_UNLOCK();
+    return BUS_EMPTY;
   }
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
   // Check the Answer
   if(0 == strcmp(answer, "MIX:  OK\n")){
-      displayMix(mixer_state);
-      // Update the Mixer Time to change in the next 30 seconds
-      time_last_change_mixer.tv_nsec = current.tv_nsec;
-      time_last_change_mixer.tv_sec = current.tv_sec;
-      return 0;
+      displayMix(state);
+  } else {
+      // Not changed, try again in the next activation
+      STATE_LOCK();
+      time_last_change_mixer = last;
+      STATE_UNLOCK();
   }
-  if (strcmp(answer, error_string)==0){
-    emg_mode = 1;
+  return BUS_OK;
+}
+
+//-------------------------------------
+//-  Function: task_mixer
+//-------------------------------------
+int task_mixer()
+{
+  if (get_emg_mode())
+    return EMERGENCY_MODE;
+  if (mixer_toggle() == BUS_EMPTY){
+    set_emg_mode();
     return EMERGENCY_MODE;
   }
   return 0;
@@ -504,86 +434,65 @@ int task_mixer()
 //-------------------------------------
 int task_mixer_emg_mode()
 {
-
-  char request[10];
-  char answer[10];
-
-// Compute the time when the mixer needs to send the request to the arduino
-  struct timespec current, lapse;
-  clock_gettime(CLOCK_REALTIME, &current);
-  diffT(current, time_last_change_mixer, &lapse);
-  // Wait 30 seconds until changes the state
-	if(lapse.tv_sec > 30) {
-		if(mixer_state) {
-			strcpy(request, "MIX: CLR\n");
-			mixer_state = 0;
-		} else {
-			strcpy(request, "MIX: SET\n");
-			mixer_state = 1;
-		}
-  }
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-  // Check the Answer
-  if(0 == strcmp(answer, "MIX:  OK\n")){
-      displayMix(mixer_state);
-      // Update the Mixer Time to change in the next 30 seconds
-      time_last_change_mixer.tv_nsec = current.tv_nsec;
-      time_last_change_mixer.tv_sec = current.tv_sec;
-      return 0;
-  }
-  if (strcmp(answer, error_string)==0){
-    emg_mode = 1;
+  if (mixer_toggle() == BUS_EMPTY){
+    set_emg_mode();
     return EMERGENCY_MODE;
   }
   return 0;
 }
 
 //-------------------------------------
-//-  Function: read_light_sensor
+//-  Function: refresh_dark
+//-  Reads the light into the sensor cache. Returns
+//-  BUS_EMPTY, and goes to emergency, if the slave does
+//-  not answer.
 //-------------------------------------
-int task_light_sensor()
+int refresh_dark()
 {
-    if (emg_mode)
-      return EMERGENCY_MODE;
-    char request[10];
-    char answer[10];
+    char answer[MSG_BUF];
 
 	// Insert the request
-	strcpy(request, "LIT: REQ\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+    if (bus_transfer(BUS_LIT_REQ, answer) == BUS_EMPTY){
+      set_emg_mode();
+      return BUS_EMPTY;
+    }
     // Check
 	int light = 0;
 	if(sscanf(answer, "LIT:%d\n", &light) == 1) {
 
         // If the returned value is below of 50%, we request to switch on the lights.
-		dark = light < 50 ? 1 : 0;
-		displayLightSensor(dark);
+		int is_dark = light < 50 ? 1 : 0;
+		sensor_set(SENSOR_DARK, is_dark);
+		displayLightSensor(is_dark);
 
 	}
-  if (strcmp(answer, error_string)==0){
-    emg_mode = 1;
-    return EMERGENCY_MODE;
-  }
-	return light;
+	return BUS_OK;
+}
+
+//-------------------------------------
+//-  Function: get_dark
+//-  Light acquired at most DARK_MAX_AGE_MS ago, or
+//-  SENSOR_STALE with the old one as get_speed.
+//-------------------------------------
+int get_dark(int *is_dark)
+{
+    struct sensor_sample sample;
+    int status = sensor_read(SENSOR_DARK, DARK_MAX_AGE_MS * NS_PER_MS,
+                             refresh_dark, &sample);
+    *is_dark = (int)sample.value;
+    return status;
+}
+
+//-------------------------------------
+//-  Function: read_light_sensor
+//-------------------------------------
+int task_light_sensor()
+{
+    if (get_emg_mode())
+      return EMERGENCY_MODE;
+    if (refresh_dark() == BUS_EMPTY)
+      return EMERGENCY_MODE;
+    return 0;
 }
 
 //-------------------------------------
@@ -591,35 +500,27 @@ int task_light_sensor()
 //-------------------------------------
 int task_lights_turn()
 {
-  if (emg_mode)
+  if (get_emg_mode())
     return EMERGENCY_MODE;
-  char request[10];
-  char answer[10];
+  char answer[MSG_BUF];
+  int cmd, is_dark;
 
     // Check is variable is dark or not
-	if(dark) {
-		strcpy(request, "LAM: SET\n");
+	if (get_dark(&is_dark) != SENSOR_OK)
+	  return sensor_stale();
+	if(is_dark) {
+		cmd = BUS_LAM_SET;
 	} else {
-		strcpy(request, "LAM: CLR\n");
+		cmd = BUS_LAM_CLR;
 	}
-	displayLamps(dark);
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
+	displayLamps(is_dark);
+
+    if (bus_transfer(cmd, answer) == BUS_EMPTY){
+      set_emg_mode();
+      return EMERGENCY_MODE;
+    }
     if (strcmp(answer,"LAM:  OK\n")==0){
     	return 1;
-    }
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
-      return EMERGENCY_MODE;
     }
 	return -1;
 }
@@ -629,27 +530,15 @@ int task_lights_turn()
 //-------------------------------------
 int task_lights_turn_brake_mode()
 {
-  if (emg_mode)
+  if (get_emg_mode())
     return EMERGENCY_MODE;
-	char request[10];
-  char answer[10];
+  char answer[MSG_BUF];
 
   // Turn on since it is in braking mode
-	strcpy(request, "LAM: SET\n");
 	displayLamps(1);
 
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-  if (strcmp(answer, error_string)==0){
-    emg_mode = 1;
+  if (bus_transfer(BUS_LAM_SET, answer) == BUS_EMPTY){
+    set_emg_mode();
     return EMERGENCY_MODE;
   }
 	return strcmp(answer,"LAM:  OK\n");
@@ -669,30 +558,13 @@ int task_lights_emg_mode()
 //-------------------------------------
 int task_read_movement()
 {
-  if (emg_mode)
+  if (get_emg_mode())
     return EMERGENCY_MODE;
-  char request[10];
-  char answer[10];
-
-  //clear request and answer
-  memset(request,'\0',10);
-  memset(answer,'\0',10);
+  char answer[MSG_BUF];
 
   // request movement
-  strcpy(request, "STP: REQ\n");
-
-#ifdef RASPBERRYPI
-  // use Raspberry Pi I2C serial module
-  write(fd_i2c, request, MSG_LEN);
-  nanosleep(&time_msg, NULL);
-  read(fd_i2c, answer, MSG_LEN);
-  answer[8] = '\n';
-#else
-  //Use the simulator
-  simulator(request, answer);
-#endif
-  if (strcmp(answer, error_string)==0){
-    emg_mode = 1;
+  if (bus_transfer(BUS_STP_REQ, answer) == BUS_EMPTY){
+    set_emg_mode();
     return EMERGENCY_MODE;
   }
   if(strcmp(answer, "STP:  GO\n") == 0){
@@ -717,37 +589,22 @@ int task_read_movement()
 //-------------------------------------
 int task_distance()
 {
-  if (emg_mode)
+  if (get_emg_mode())
     return EMERGENCY_MODE;
 
-  char request[10];
-  char answer[10];
-
-  //clear request and answer
-  memset(request,'\0',10);
-  memset(answer,'\0',10);
+  char answer[MSG_BUF];
+  unsigned int distance;
 
   // request distance
-  strcpy(request, "DS:  REQ\n");
-
-  #ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-  #else
-    //Use the simulator
-    simulator(request, answer);
-  #endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(BUS_DS_REQ, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
-    if(sscanf(answer, "DS:%u\n", &current_distance) == 1){
-      displayDistance(current_distance);
+    if(sscanf(answer, "DS:%u\n", &distance) == 1){
+      sensor_set(SENSOR_DISTANCE, distance);
+      displayDistance(distance);
 
-    	if(current_distance < 11000 && current_distance > 0) {
+    	if(distance < 11000 && distance > 0) {
             return BRAKING_MODE;
     	}else{
     		return NORMAL_MODE;
@@ -765,39 +622,28 @@ int task_distance()
 //-------------------------------------
 int task_distance_brake_mode()
 {
-  if (emg_mode)
+  if (get_emg_mode())
     return EMERGENCY_MODE;
 
-  char request[10];
-  char answer[10];
-
-  //clear request and answer
-  memset(request,'\0',10);
-  memset(answer,'\0',10);
+  char answer[MSG_BUF];
+  unsigned int distance;
+  float speed;
 
   // request distance in brake mode
-  strcpy(request, "DS:  REQ\n");
-
-  #ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-  #else
-    //Use the simulator
-    simulator(request, answer);
-  #endif
-    if (strcmp(answer, error_string)==0){
-      emg_mode = 1;
+    if (bus_transfer(BUS_DS_REQ, answer) == BUS_EMPTY){
+      set_emg_mode();
       return EMERGENCY_MODE;
     }
-    if(sscanf(answer, "DS:%u\n", &current_distance) == 1){
-      displayDistance(current_distance);
-
-    	if(current_distance <= 0 && speed <= 10) {
-            current_distance = 0;
-            displayDistance(current_distance);
+    if(sscanf(answer, "DS:%u\n", &distance) == 1){
+      sensor_set(SENSOR_DISTANCE, distance);
+      displayDistance(distance);
+
+    	// a stale speed cannot tell the wagon stopped, keep braking
+    	if(distance <= 0 && get_speed(&speed) != SENSOR_OK) {
+    		return get_emg_mode() ? EMERGENCY_MODE : BRAKING_MODE;
+    	} else if(distance <= 0 && speed <= 10) {
+            sensor_set(SENSOR_DISTANCE, 0);
+            displayDistance(0);
             return STOP_MODE;
     	} else {
     		return BRAKING_MODE;
@@ -811,224 +657,295 @@ int task_distance_brake_mode()
 }
 
 //-------------------------------------
-//-  Function: enable_emg_mode
+//-  Function: read_sensors()
+//-  Stores the speed and the distance read in value and
+//-  distance.
 //-------------------------------------
-int enable_emg_mode()
+int read_sensors(float *value, unsigned int *distance)
+{
+  char answer[MSG_LONG_BUF];
+  char slope;
+  int light, is_dark, status;
+
+  if (bus_get_caps() & BUS_CAP_REGISTERS) {
+    // burst read of speed to distance, no text to parse
+    struct bus_regs regs;
+    status = bus_read_regs(BUS_REG_SPEED, BUS_REG_MODE - BUS_REG_SPEED,
+                           &regs);
+    if (status == BUS_EMPTY){
+      set_emg_mode();
+      return EMERGENCY_MODE;
+    }
+    if (status != BUS_OK)
+      return -1;
+    *value = regs.speed;
+    slope = "FUD-"[regs.slope & 3];
+    light = regs.light;
+    *distance = regs.distance > 0 ? (unsigned int)(regs.distance + 0.5) : 0;
+  } else {
+    // request speed, slope, light and distance in one frame
+    if (bus_transfer(BUS_SNS_REQ, answer) == BUS_EMPTY){
+      set_emg_mode();
+      return EMERGENCY_MODE;
+    }
+    if (4 != sscanf(answer, "SNS%5f%c%2d%5u\n",
+                    value, &slope, &light, distance)){
+      // Error Reading
+      return -1;
+    }
+  }
+  // If the returned value is below of 50%, we request to switch on the lights.
+  is_dark = light < 50 ? 1 : 0;
+  sensor_set(SENSOR_SPEED, *value);
+  sensor_set(SENSOR_DARK, is_dark);
+  sensor_set(SENSOR_DISTANCE, *distance);
+
+  displaySpeed(*value);
+  if (slope == 'D') displaySlope(-1);
+  else if (slope == 'F') displaySlope(0);
+  else if (slope == 'U') displaySlope(1);
+
+  displayLightSensor(is_dark);
+  displayDistance(*distance);
+  return 0;
+}
+
+//-------------------------------------
+//-  Function: task_sensors()
+//-------------------------------------
+int task_sensors()
 {
-    char request[10];
-    char answer[10];
+  if (get_emg_mode())
+    return EMERGENCY_MODE;
 
-    // Check if it's already in Emergency Mode
-    if (emg_mode==1) return EMERGENCY_MODE;
+  float value;
+  unsigned int distance;
+  int status = read_sensors(&value, &distance);
+  if (status == EMERGENCY_MODE)
+    return EMERGENCY_MODE;
+  if (status == 0 && distance < 11000 && distance > 0)
+    return BRAKING_MODE;
+  return NORMAL_MODE;
+}
 
-    //clear request and answer
-    memset(request,'\0',10);
-    memset(answer,'\0',10);
+//-------------------------------------
+//-  Function: task_sensors_brake_mode()
+//-------------------------------------
+int task_sensors_brake_mode()
+{
+  if (get_emg_mode())
+    return EMERGENCY_MODE;
 
-    // Send the emg mode to the Arduino
-    strcpy(request, "ERR: SET\n");
-
-#ifdef RASPBERRYPI
-    // use Raspberry Pi I2C serial module
-    write(fd_i2c, request, MSG_LEN);
-    nanosleep(&time_msg, NULL);
-    read(fd_i2c, answer, MSG_LEN);
-    answer[8] = '\n';
-#else
-    //Use the simulator
-    simulator(request, answer);
-#endif
-    // Check The answer from arduino
-    if(strcmp(answer, "ERR:  OK\n") == 0){
-      emg_mode=1;
-		  return EMERGENCY_MODE;
-    }
+  float value;
+  unsigned int distance;
+  int status = read_sensors(&value, &distance);
+  if (status == EMERGENCY_MODE)
     return EMERGENCY_MODE;
+  if (status != 0)
+    return STOP_MODE;
+  if (distance <= 0 && value <= 10)
+    return STOP_MODE;
+  return BRAKING_MODE;
 }
 
 //-------------------------------------
-//-  Function: Normal execution
+//-  Function: task_actuators()
 //-------------------------------------
-int normal_execution(){
-  int mode = NORMAL_MODE;
-  int secondary_cycle = 0;
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) 0;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
+int task_actuators()
+{
+  if (get_emg_mode())
+    return EMERGENCY_MODE;
+  char answer[MSG_BUF];
+  int accelerate, is_dark;
+  float speed;
+
+  if (get_speed(&speed) != SENSOR_OK || get_dark(&is_dark) != SENSOR_OK)
+    return sensor_stale();
+  accelerate = speed <= 55.0;
+
+  // Gas, brake and lamps in one frame
+  displayGas(accelerate);
+  displayBrake(!accelerate);
+  displayLamps(is_dark);
+  if (bus_transfer_act(accelerate ? BUS_ACT_SET : BUS_ACT_CLR,
+                       accelerate ? BUS_ACT_CLR : BUS_ACT_SET,
+                       is_dark ? BUS_ACT_SET : BUS_ACT_CLR,
+                       answer) == BUS_EMPTY){
+    set_emg_mode();
+    return EMERGENCY_MODE;
   }
+  return strcmp(answer, "ACT:  OK\n");
+}
 
-  while (mode == NORMAL_MODE){
-    switch(secondary_cycle){
-        case 0:
-            task_slope();
-            mode = task_distance();
-            task_mixer();
-            task_light_sensor();
-            task_lights_turn();
-            break;
-
-        case 1:
-            task_speed();
-            task_acc();
-            task_brake();
-            task_light_sensor();
-            task_lights_turn();
-            break;
-    }
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
-    secondary_cycle = (secondary_cycle+1) %2;
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
+//-------------------------------------
+//-  Function: task_actuators_brake_mode()
+//-------------------------------------
+int task_actuators_brake_mode()
+{
+  if (get_emg_mode())
+    return EMERGENCY_MODE;
+  char answer[MSG_BUF];
+  int accelerate;
+  float speed;
+
+  if (get_speed(&speed) != SENSOR_OK)
+    return sensor_stale();
+  accelerate = speed <= 2.5;
+
+  // Gas and brake in one frame, lamps on since it is in braking mode
+  displayGas(accelerate);
+  displayBrake(!accelerate);
+  displayLamps(1);
+  if (bus_transfer_act(accelerate ? BUS_ACT_SET : BUS_ACT_CLR,
+                       accelerate ? BUS_ACT_CLR : BUS_ACT_SET,
+                       BUS_ACT_SET, answer) == BUS_EMPTY){
+    set_emg_mode();
+    return EMERGENCY_MODE;
   }
-
-  return mode;
+  return strcmp(answer, "ACT:  OK\n");
 }
 
 //-------------------------------------
-//-  Function: Braking execution
+//-  Function: task_actuators_emg_mode()
 //-------------------------------------
-int braking_execution(){
-  int mode = BRAKING_MODE;
-  int secondary_cycle = 0;
-
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) 0;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
+int task_actuators_emg_mode()
+{
+  static const int cmds[] = {BUS_GAS_CLR, BUS_BRK_SET};
+  char answers[2][MSG_BUF];
+
+  // Gas off and brake on, both queued before reading any answer
+  displayGas(0);
+  displayBrake(1);
+  if (bus_transfer_pipe(cmds, 2, answers) == BUS_EMPTY){
+    set_emg_mode();
+    return EMERGENCY_MODE;
   }
+  return strcmp(answers[0], "GAS:  OK\n") || strcmp(answers[1], "BRK:  OK\n");
+}
 
-  while (mode == BRAKING_MODE){
-    switch(secondary_cycle){
-        case 0:
-            task_speed();
-            task_acc_brake_mode();
-            task_brake_brake_mode();
-            task_slope();
-            mode = task_distance_brake_mode();
-            break;
-
-        case 1:
-            task_speed();
-            task_acc_brake_mode();
-            task_brake_brake_mode();
-            task_mixer();
-            break;
-        case 2:
-            task_speed();
-            task_acc_brake_mode();
-            task_brake_brake_mode();
-            task_slope();
-            mode = task_distance_brake_mode();
-          break;
-        case 3:
-            task_speed();
-            task_acc_brake_mode();
-            task_brake_brake_mode();
-            task_mixer();
-          break;
-        case 4:
-            task_speed();
-            task_acc_brake_mode();
-            task_brake_brake_mode();
-            task_slope();
-            mode = task_distance_brake_mode();
-          break;
-        case 5:
-            task_speed();
-            task_acc_brake_mode();
-            task_brake_brake_mode();
-            task_lights_turn_brake_mode();
-          break;
+//-------------------------------------
+//-  Function: enable_emg_mode
+//-------------------------------------
+int enable_emg_mode()
+{
+    char answer[MSG_BUF];
 
-    }
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
-    secondary_cycle = (secondary_cycle+1) %6;
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
+    // Check if it's already in Emergency Mode
+    if (get_emg_mode()) return EMERGENCY_MODE;
 
-  }
-  return mode;
+    // Send the emg mode to the Arduino
+    bus_transfer(BUS_ERR_SET, answer);
+    // Check The answer from arduino
+    if(strcmp(answer, "ERR:  OK\n") == 0){
+      set_emg_mode();
+		  return EMERGENCY_MODE;
+    }
+    return EMERGENCY_MODE;
 }
 
 //-------------------------------------
-//-  Function: Stop execution
+//-  Task table
 //-------------------------------------
-int stop_execution(){
-  int mode = STOP_MODE;
+#define NORMAL CYCLIC_MODE(NORMAL_MODE)
+#define BRAKING CYCLIC_MODE(BRAKING_MODE)
+#define STOP CYCLIC_MODE(STOP_MODE)
+#define EMERGENCY CYCLIC_MODE(EMERGENCY_MODE)
+#define COMPOUND BUS_CAP_COMPOUND
+#define PIPELINE BUS_CAP_PIPELINE
+
+// Tasks run in table order inside each secondary cycle
+const struct cyclic_task tasks[] = {
+  // name                    function                     modes           T  ph  WCET         flags             needs     replaced by
+  {"sensors",                task_sensors,                NORMAL,         1, 0,  WCET_BUS_MS, CYCLIC_SETS_MODE, COMPOUND, 0},
+  {"actuators",              task_actuators,              NORMAL,         1, 0,  WCET_BUS_MS, CYCLIC_CRITICAL,  COMPOUND, 0},
+  {"sensors_brake_mode",     task_sensors_brake_mode,     BRAKING,        1, 0,  WCET_BUS_MS, CYCLIC_SETS_MODE, COMPOUND, 0},
+  {"actuators_brake_mode",   task_actuators_brake_mode,   BRAKING,        1, 0,  WCET_BUS_MS, CYCLIC_CRITICAL,  COMPOUND, 0},
+  {"speed",                  task_speed,                  BRAKING,        1, 0,  WCET_BUS_MS, 0,                0,        COMPOUND},
+  {"acc_brake_mode",         task_acc_brake_mode,         BRAKING,        1, 0,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        COMPOUND},
+  {"brake_brake_mode",       task_brake_brake_mode,       BRAKING,        1, 0,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        COMPOUND},
+  {"slope",                  task_slope,                  NORMAL|BRAKING, 2, 0,  WCET_BUS_MS, 0,                0,        COMPOUND},
+  {"distance",               task_distance,               NORMAL,         2, 0,  WCET_BUS_MS, CYCLIC_SETS_MODE, 0,        COMPOUND},
+  {"distance_brake_mode",    task_distance_brake_mode,    BRAKING,        2, 0,  WCET_BUS_MS, CYCLIC_SETS_MODE, 0,        COMPOUND},
+  {"read_movement",          task_read_movement,          STOP,           1, 0,  WCET_BUS_MS, CYCLIC_SETS_MODE, 0,        0},
+  {"mixer",                  task_mixer,                  NORMAL,         2, 0,  WCET_BUS_MS, CYCLIC_SHEDDABLE, 0,        0},
+  {"mixer",                  task_mixer,                  BRAKING,        6, 1,  WCET_BUS_MS, CYCLIC_SHEDDABLE, 0,        0},
+  {"mixer",                  task_mixer,                  BRAKING,        6, 3,  WCET_BUS_MS, CYCLIC_SHEDDABLE, 0,        0},
+  {"mixer",                  task_mixer,                  STOP,           1, 0,  WCET_BUS_MS, CYCLIC_SHEDDABLE, 0,        0},
+  {"speed",                  task_speed,                  NORMAL,         2, 1,  WCET_BUS_MS, 0,                0,        COMPOUND},
+  {"acc",                    task_acc,                    NORMAL,         2, 1,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        COMPOUND},
+  {"brake",                  task_brake,                  NORMAL,         2, 1,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        COMPOUND},
+  {"light_sensor",           task_light_sensor,           NORMAL,         1, 0,  WCET_BUS_MS, CYCLIC_SHEDDABLE, 0,        COMPOUND},
+  {"lights_turn",            task_lights_turn,            NORMAL,         1, 0,  WCET_BUS_MS, 0,                0,        COMPOUND},
+  {"lights_turn_brake_mode", task_lights_turn_brake_mode, BRAKING,        6, 5,  WCET_BUS_MS, 0,                0,        COMPOUND},
+  {"lights_turn_brake_mode", task_lights_turn_brake_mode, STOP,           1, 0,  WCET_BUS_MS, 0,                0,        0},
+  {"slope_emg_mode",         task_slope_emg_mode,         EMERGENCY,      2, 0,  WCET_BUS_MS, 0,                0,        0},
+  {"mixer_emg_mode",         task_mixer_emg_mode,         EMERGENCY,      2, 0,  WCET_BUS_MS, 0,                0,        0},
+  {"enable_emg_mode",        enable_emg_mode,             EMERGENCY,      2, 0,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        0},
+  {"speed_emg_mode",         task_speed_emg_mode,         EMERGENCY,      2, 1,  WCET_BUS_MS, 0,                0,        0},
+  {"acc_emg_mode",           task_acc_emg_mode,           EMERGENCY,      2, 1,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        PIPELINE},
+  {"brake_emg_mode",         task_brake_emg_mode,         EMERGENCY,      2, 1,  WCET_BUS_MS, CYCLIC_CRITICAL,  0,        PIPELINE},
+  {"actuators_emg_mode",     task_actuators_emg_mode,     EMERGENCY,      2, 1,  WCET_BUS_MS, CYCLIC_CRITICAL,  PIPELINE, 0},
+  {"lights_emg_mode",        task_lights_emg_mode,        EMERGENCY,      1, 0,  WCET_BUS_MS, 0,                0,        0},
+};
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+struct cyclic_schedule schedules[NUM_MODES];
 
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) 0;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
+//-------------------------------------
+//-  Function: build_schedules
+//-------------------------------------
+int build_schedules()
+{
+  int mode;
+  for (mode = 0; mode < NUM_MODES; mode++){
+    if (cyclic_build(tasks, NUM_TASKS, mode, bus_get_caps(),
+                     TIME_CYCLE_SEC * 1000L, &schedules[mode]) != 0)
+      return -1;
+    cyclic_set_reaction(&schedules[mode], MISS_REACTION, EMERGENCY_MODE);
   }
-  while (mode == STOP_MODE){
-    mode = task_read_movement();
-    task_mixer();
-    task_lights_turn_brake_mode();
+  return 0;
+}
 
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
-  }
-  return mode;
+//-------------------------------------
+//-  Function: print_stats
+//-  Timing report: task run and response times, frame
+//-  utilization, bus latencies and release jitter.
+//-------------------------------------
+void print_stats(int mode){
+  static const char *names[NUM_MODES] = {
+    "NORMAL", "BRAKING", "STOP", "EMERGENCY"
+  };
+#ifdef RM_THREADS
+  printf("Mode %s\n", names[mode]);
+  rm_print_stats();
+#else
+  cyclic_print_stats(&schedules[mode], names[mode]);
+  periodic_print(&loop);
+#endif
+  bus_print_stats();
+  sensor_print_stats();
+  trace_print_stats();
+  time_last_dump = time_now();
 }
 
 //-------------------------------------
-//-  Function: Emergency execution
+//-  Function: mode_execution
 //-------------------------------------
-int emg_execution(){
-  int mode = EMERGENCY_MODE;
+int mode_execution(int mode){
+  int next_mode = mode;
   int secondary_cycle = 0;
-  struct timespec start, end, diff, period;
-  period.tv_sec = (time_t) TIME_CYCLE_SEC;
-  period.tv_nsec = (long) TIME_CYCLE_NSEC;
-  if( clock_gettime( CLOCK_REALTIME, &start) == -1 ) {
-      printf("Error obtaining starting time\n");
-  }
-
-  while (mode == EMERGENCY_MODE){
-    switch(secondary_cycle){
-        case 0:
-            task_slope_emg_mode();
-            task_mixer_emg_mode();
-            enable_emg_mode();
-            task_lights_emg_mode();
-            break;
-
-        case 1:
-            task_speed_emg_mode();
-            task_acc_emg_mode();
-            task_brake_emg_mode();
-            task_lights_emg_mode();
-            break;
-    }
-    if(clock_gettime(CLOCK_REALTIME, &end)==-1){
-    	printf("Error obtaining ending time\n");
-    }
-    secondary_cycle = (secondary_cycle+1) %2;
-    diffT(end, start, &diff);
-    diffT(period, diff, &diff);
-    nanosleep(&diff, NULL);
-    addT(start, period, &start);
 
+  while (next_mode == mode){
+    next_mode = cyclic_run_frame(&schedules[mode], secondary_cycle, mode,
+                                 loop.release);
+    secondary_cycle = (secondary_cycle+1) % schedules[mode].frames;
+    if (time_now() - time_last_dump >= STATS_DUMP_SEC * NS_PER_S)
+      print_stats(mode);
+    // Sleep until the absolute release of the next cycle
+    periodic_wait(&loop);
   }
-  return mode;
+
+  return next_mode;
 }
 
 //-------------------------------------
@@ -1038,25 +955,35 @@ void *controller(void *arg)
 {
     int mode = 0;
     mixer_state = 0;
-    clock_gettime( CLOCK_REALTIME, &time_last_change_mixer);
+    time_last_change_mixer = time_now();
+    periodic_init(&loop, "secondary", TIME_CYCLE_SEC * NS_PER_S,
+                  OVERRUN_POLICY);
+    time_last_dump = time_now();
+
+#ifdef RM_THREADS
+    // Every task runs in its own thread, this one only reports
+    if (rm_start(tasks, NUM_TASKS, bus_get_caps(),
+                 TIME_CYCLE_SEC * NS_PER_S, mode) != 0)
+      exit(1);
+    while(1) {
+      periodic_wait(&loop);
+      if (rm_get_mode() != mode ||
+          time_now() - time_last_dump >= STATS_DUMP_SEC * NS_PER_S) {
+        print_stats(mode);
+        mode = rm_get_mode();
+      }
+    }
+#else
+    int next_mode;
 
     // Endless loop
     while(1) {
-      switch(mode){
-        case NORMAL_MODE: //Normal mode
-          mode = normal_execution();
-          break;
-        case BRAKING_MODE: //Braking mode
-          mode = braking_execution();
-          break;
-        case STOP_MODE: //Stop mode
-          mode = stop_execution();
-          break;
-        case EMERGENCY_MODE: //Emergency mode
-          mode = emg_execution();
-          break;
-      }
+      next_mode = mode_execution(mode);
+      // Report the timing observed in the mode just left
+      print_stats(mode);
+      mode = next_mode;
     }
+#endif
 }
 
 //-------------------------------------
@@ -1081,19 +1008,23 @@ rtems_task Init (rtems_task_argument ignored)
     // init display
     displayInit(SIGRTMAX);
 
-#ifdef RASPBERRYPI
-    // Init the i2C driver
-    rpi_i2c_init();
-
-    // bus registering, this init the ports needed for the conexion
-    // and register the device under /dev/i2c
-    rpi_i2c_register_bus("/dev/i2c", 10000);
-
-    // open device file
-    fd_i2c = open("/dev/i2c", O_RDWR);
+    // init the I2C bus (or the simulator) and ask for the
+    // compound commands, falling back to the 8-byte ones
+    bus_init();
+    if (trace_start() != 0)
+        exit(1);
+    bus_probe_caps();
+    if (sensor_init() != 0)
+        exit(1);
+
+    // build the secondary cycles of every mode from the task table
+    if (build_schedules() != 0) {
+        printf("Task set does not fit in the secondary cycle\n");
+        exit(1);
+    }
 
-    // register the address of the slave to comunicate with
-    ioctl(fd_i2c, I2C_SLAVE, SLAVE_ADDR);
+#ifdef RM_THREADS
+    rm_mutex_init(&state_lock);
 #endif
 
     /* Create first thread */
@@ -1110,7 +1041,17 @@ rtems_task Init (rtems_task_argument ignored)
 #define CONFIGURE_MAXIMUM_SEMAPHORES 10
 #define CONFIGURE_MAXIMUM_FILE_DESCRIPTORS 30
 #define CONFIGURE_MAXIMUM_DIRVER 10
-#define CONFIGURE_MAXIMUM_POSIX_THREADS 2
+#ifdef RM_THREADS
+// Init, controller, trace flusher and one thread per task; bus,
+// mode, state, sensor and trace mutexes
+#define CONFIGURE_MAXIMUM_POSIX_THREADS (RM_MAX_THREADS + 3)
+#define CONFIGURE_MAXIMUM_POSIX_MUTEXES 5
+#else
+// controller and trace flusher; bus, sensor and trace mutexes
+#define CONFIGURE_MAXIMUM_POSIX_THREADS 3
+#define CONFIGURE_MAXIMUM_POSIX_MUTEXES 3
+#endif
+#define CONFIGURE_MAXIMUM_POSIX_SEMAPHORES 1
 #define CONFIGURE_MAXIMUM_POSIX_TIMERS 1
 
 #define CONFIGURE_INIT
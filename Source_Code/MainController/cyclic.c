@@ -0,0 +1,242 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "cyclic.h"
+#include "trace.h"
+
+/**********************************************************
+ *  Function: gcd
+ *********************************************************/
+static int gcd(int a, int b)
+{
+    while (b != 0) {
+        int aux = a % b;
+        a = b;
+        b = aux;
+    }
+    return a;
+}
+
+/**********************************************************
+ *  Function: cyclic_selected
+ *********************************************************/
+static int cyclic_selected(const struct cyclic_task *task, int mode,
+                           int caps)
+{
+    if (!(task->modes & CYCLIC_MODE(mode)))
+        return 0;
+    if ((caps & task->caps_required) != task->caps_required)
+        return 0;
+    if (caps & task->caps_excluded)
+        return 0;
+    return 1;
+}
+
+/**********************************************************
+ *  Function: cyclic_build
+ *
+ *  Builds the frames of mode from the tasks of table that
+ *  run with the bus capabilities caps. The major cycle is
+ *  the least common multiple of the periods. Returns -1,
+ *  after printing why, if the task set does not fit.
+ *********************************************************/
+int cyclic_build(const struct cyclic_task *table, int n, int mode,
+                 int caps, long frame_ms, struct cyclic_schedule *sched)
+{
+    int i, f;
+    long load;
+
+    memset(sched, 0, sizeof(*sched));
+    sched->frame_ms = frame_ms;
+    sched->table = table;
+    sched->n = n;
+    if (n > CYCLIC_MAX_TASKS) {
+        printf("Mode %d: more than %d tasks in the table\n",
+               mode, CYCLIC_MAX_TASKS);
+        return -1;
+    }
+
+    // Major cycle
+    sched->frames = 1;
+    for (i = 0; i < n; i++) {
+        if (!cyclic_selected(&table[i], mode, caps))
+            continue;
+        if (table[i].period < 1 || table[i].phase < 0 ||
+            table[i].phase >= table[i].period) {
+            printf("Mode %d: bad period or phase of %s\n",
+                   mode, table[i].name);
+            return -1;
+        }
+        sched->frames = sched->frames * table[i].period /
+                        gcd(sched->frames, table[i].period);
+        if (sched->frames > CYCLIC_MAX_FRAMES) {
+            printf("Mode %d: major cycle longer than %d frames\n",
+                   mode, CYCLIC_MAX_FRAMES);
+            return -1;
+        }
+    }
+
+    // Place the tasks in table order
+    for (f = 0; f < sched->frames; f++) {
+        load = 0;
+        for (i = 0; i < n; i++) {
+            if (!cyclic_selected(&table[i], mode, caps) ||
+                f % table[i].period != table[i].phase)
+                continue;
+            if (sched->count[f] == CYCLIC_MAX_SLOTS) {
+                printf("Mode %d: more than %d tasks in frame %d\n",
+                       mode, CYCLIC_MAX_SLOTS, f);
+                return -1;
+            }
+            sched->slots[f][sched->count[f]++] = &table[i];
+            load += table[i].wcet_ms;
+        }
+        if (load > frame_ms) {
+            printf("Mode %d: frame %d needs %ld ms of %ld ms\n",
+                   mode, f, load, frame_ms);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**********************************************************
+ *  Function: cyclic_set_reaction
+ *********************************************************/
+void cyclic_set_reaction(struct cyclic_schedule *sched, int reaction,
+                         int miss_mode)
+{
+    sched->reaction = reaction;
+    sched->miss_mode = miss_mode;
+}
+
+/**********************************************************
+ *  Function: cyclic_miss
+ *
+ *  Records a frame that ended overrun ns after its
+ *  deadline and returns the next mode after the reaction.
+ *********************************************************/
+static int cyclic_miss(struct cyclic_schedule *sched, int frame,
+                       nsec_t end, nsec_t overrun,
+                       const struct cyclic_task *longest,
+                       nsec_t longest_ns, int mode)
+{
+    struct cyclic_miss *miss = &sched->ring[sched->misses % CYCLIC_MISS_RING];
+
+    miss->time = end;
+    miss->frame = frame;
+    miss->overrun = overrun;
+    miss->longest = longest ? longest->name : "-";
+    miss->longest_ns = longest_ns;
+    sched->misses++;
+    sched->overrun_sum += overrun;
+    if (overrun > sched->overrun_max)
+        sched->overrun_max = overrun;
+
+    switch (sched->reaction) {
+        case CYCLIC_REACT_SHED:
+            sched->shed = sched->frames;
+            break;
+        case CYCLIC_REACT_MODE:
+            return sched->miss_mode;
+    }
+    return mode;
+}
+
+/**********************************************************
+ *  Function: cyclic_run_frame
+ *
+ *  Runs the tasks of one frame and returns the next mode.
+ *  One clock read per task: each task starts when the
+ *  previous one ends. The deadline and the response times
+ *  count from release, the periodic release time of the
+ *  frame, so a frame that starts late is not given the
+ *  time it lost.
+ *********************************************************/
+int cyclic_run_frame(struct cyclic_schedule *sched, int frame, int mode,
+                     nsec_t release)
+{
+    const struct cyclic_task *task, *longest = NULL;
+    nsec_t start, begin, end, longest_ns = 0;
+    nsec_t deadline;
+    int i, ret;
+
+    trace_context(mode, frame);
+    start = end = time_now();
+    deadline = release + sched->frame_ms * NS_PER_MS;
+    for (i = 0; i < sched->count[frame]; i++) {
+        task = sched->slots[frame][i];
+        if (sched->shed > 0 && (task->flags & CYCLIC_SHEDDABLE)) {
+            sched->shed_runs++;
+            continue;
+        }
+        begin = end;
+        ret = task->run();
+        end = time_now();
+        histo_add(&sched->exec[task - sched->table], end - begin);
+        histo_add(&sched->response[task - sched->table], end - release);
+        if (end - begin > longest_ns) {
+            longest = task;
+            longest_ns = end - begin;
+        }
+        if (task->flags & CYCLIC_SETS_MODE)
+            mode = ret;
+    }
+    histo_add(&sched->busy, end - start);
+
+    if (sched->shed > 0)
+        sched->shed--;
+    if (end > deadline)
+        mode = cyclic_miss(sched, frame, end, end - deadline, longest,
+                           longest_ns, mode);
+    return mode;
+}
+
+/**********************************************************
+ *  Function: cyclic_print_stats
+ *
+ *  Run time and response time (from the release of the
+ *  frame) of every task, and how much of the frame the
+ *  tasks use.
+ *********************************************************/
+void cyclic_print_stats(const struct cyclic_schedule *sched,
+                        const char *title)
+{
+    nsec_t frame = sched->frame_ms * NS_PER_MS;
+    int i;
+
+    if (sched->busy.count == 0)
+        return;
+    histo_print_header(title);
+    for (i = 0; i < sched->n; i++)
+        histo_print(sched->table[i].name, &sched->exec[i]);
+    histo_print_header("response");
+    for (i = 0; i < sched->n; i++)
+        histo_print(sched->table[i].name, &sched->response[i]);
+    histo_print("frame busy", &sched->busy);
+    printf("frame utilization: mean %lld%%, p99 %lld%%, max %lld%% "
+           "of %ld ms\n",
+           (long long)(histo_mean(&sched->busy) * 100 / frame),
+           (long long)(histo_percentile(&sched->busy, 99) * 100 / frame),
+           (long long)(sched->busy.max * 100 / frame), sched->frame_ms);
+
+    if (sched->misses == 0)
+        return;
+    printf("deadline misses: %lu, overrun mean %lld us, max %lld us, "
+           "%lu tasks shed\n", sched->misses,
+           (long long)(sched->overrun_sum / (nsec_t)sched->misses / 1000),
+           (long long)(sched->overrun_max / 1000), sched->shed_runs);
+    // Oldest first
+    i = sched->misses > CYCLIC_MISS_RING ? sched->misses % CYCLIC_MISS_RING : 0;
+    do {
+        const struct cyclic_miss *miss = &sched->ring[i];
+        printf("  %lld s ago: frame %d overran %lld us, longest %s %lld us\n",
+               (long long)((time_now() - miss->time) / NS_PER_S),
+               miss->frame, (long long)(miss->overrun / 1000),
+               miss->longest, (long long)(miss->longest_ns / 1000));
+        i = (i + 1) % CYCLIC_MISS_RING;
+    } while (i != (int)(sched->misses % CYCLIC_MISS_RING));
+}
@@ -0,0 +1,95 @@
+/**********************************************************
+ *  cyclic.h
+ *
+ *  Table-driven cyclic executive. Each controller mode
+ *  runs a major cycle made of secondary cycles (frames);
+ *  the frames are built at start-up from a task table
+ *  that gives the period, phase, WCET budget and modes of
+ *  every task. Every run is timed into log-scale
+ *  histograms kept per mode and task, and frames that end
+ *  after their deadline are recorded and reacted to.
+ *********************************************************/
+#ifndef CYCLIC_H
+#define CYCLIC_H
+
+#include "histo.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define CYCLIC_MAX_FRAMES 12
+#define CYCLIC_MAX_SLOTS  16
+#define CYCLIC_MAX_TASKS  32
+#define CYCLIC_MISS_RING  16  // deadline misses remembered per mode
+
+// Task flags
+#define CYCLIC_SETS_MODE 0x1  // the value returned is the next mode
+#define CYCLIC_SHEDDABLE 0x2  // may be skipped after a deadline miss
+#define CYCLIC_CRITICAL  0x4  // ranks above the other tasks in rm.h
+
+// Reaction to a frame that overruns its deadline
+#define CYCLIC_REACT_NONE 0  // only account for it
+#define CYCLIC_REACT_SHED 1  // skip the sheddable tasks for a major cycle
+#define CYCLIC_REACT_MODE 2  // switch to the miss mode
+
+// Mode mask of a task
+#define CYCLIC_MODE(m) (1 << (m))
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct cyclic_task {
+    const char *name;
+    int (*run)();
+    int modes;          // CYCLIC_MODE() mask of the modes it runs in
+    int period;         // in secondary cycles
+    int phase;          // first secondary cycle it runs in
+    int wcet_ms;        // budget used to check the frames
+    int flags;
+    int caps_required;  // bus capabilities needed to run it
+    int caps_excluded;  // bus capabilities that replace it
+};
+
+struct cyclic_miss {
+    nsec_t time;            // end of the frame
+    int frame;
+    nsec_t overrun;         // past the end of the frame
+    const char *longest;    // task that ran longest in the frame
+    nsec_t longest_ns;
+};
+
+struct cyclic_schedule {
+    int frames;
+    long frame_ms;
+    const struct cyclic_task *table;
+    int n;
+    int count[CYCLIC_MAX_FRAMES];
+    const struct cyclic_task *slots[CYCLIC_MAX_FRAMES][CYCLIC_MAX_SLOTS];
+    // instrumentation, indexed like table
+    struct histo exec[CYCLIC_MAX_TASKS];      // run time of the task
+    struct histo response[CYCLIC_MAX_TASKS];  // frame release to task end
+    struct histo busy;                        // frame start to last task end
+    // deadline misses
+    int reaction;
+    int miss_mode;          // next mode with CYCLIC_REACT_MODE
+    int shed;               // frames left without the sheddable tasks
+    unsigned long misses;
+    unsigned long shed_runs;
+    nsec_t overrun_sum;
+    nsec_t overrun_max;
+    struct cyclic_miss ring[CYCLIC_MISS_RING];  // last misses, by misses
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+int cyclic_build(const struct cyclic_task *table, int n, int mode,
+                 int caps, long frame_ms, struct cyclic_schedule *sched);
+void cyclic_set_reaction(struct cyclic_schedule *sched, int reaction,
+                         int miss_mode);
+int cyclic_run_frame(struct cyclic_schedule *sched, int frame, int mode,
+                     nsec_t release);
+void cyclic_print_stats(const struct cyclic_schedule *sched,
+                        const char *title);
+
+#endif
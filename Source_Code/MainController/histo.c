@@ -0,0 +1,92 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+
+#include "histo.h"
+
+/**********************************************************
+ *  Function: histo_bucket
+ *
+ *  Index of the highest bit set of t in microseconds.
+ *********************************************************/
+static int histo_bucket(nsec_t t)
+{
+    unsigned long long us = t > 0 ? (unsigned long long)t / 1000 : 0;
+    int b = 0;
+
+    while (us > 1 && b < HISTO_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/**********************************************************
+ *  Function: histo_add
+ *********************************************************/
+void histo_add(struct histo *h, nsec_t t)
+{
+    if (h->count == 0 || t < h->min)
+        h->min = t;
+    if (t > h->max)
+        h->max = t;
+    h->sum += t;
+    h->count++;
+    h->buckets[histo_bucket(t)]++;
+}
+
+/**********************************************************
+ *  Function: histo_mean
+ *********************************************************/
+nsec_t histo_mean(const struct histo *h)
+{
+    return h->count ? h->sum / (nsec_t)h->count : 0;
+}
+
+/**********************************************************
+ *  Function: histo_percentile
+ *
+ *  Upper bound of the bucket holding the pct percentile,
+ *  never above the maximum seen. It errs on the safe side
+ *  when used as a WCET estimate.
+ *********************************************************/
+nsec_t histo_percentile(const struct histo *h, int pct)
+{
+    unsigned long rank, seen = 0;
+    nsec_t bound;
+    int b;
+
+    if (h->count == 0)
+        return 0;
+    rank = (h->count * pct + 99) / 100;
+    for (b = 0; b < HISTO_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank)
+            break;
+    }
+    bound = ((nsec_t)2 << b) * 1000;
+    return bound < h->max ? bound : h->max;
+}
+
+/**********************************************************
+ *  Function: histo_print_header
+ *********************************************************/
+void histo_print_header(const char *title)
+{
+    printf("%-24s %7s %9s %9s %9s %9s\n", title, "count",
+           "min(us)", "mean(us)", "p99(us)", "max(us)");
+}
+
+/**********************************************************
+ *  Function: histo_print
+ *********************************************************/
+void histo_print(const char *name, const struct histo *h)
+{
+    if (h->count == 0)
+        return;
+    printf("%-24s %7lu %9lld %9lld %9lld %9lld\n", name, h->count,
+           (long long)(h->min / 1000), (long long)(histo_mean(h) / 1000),
+           (long long)(histo_percentile(h, 99) / 1000),
+           (long long)(h->max / 1000));
+}
@@ -0,0 +1,40 @@
+/**********************************************************
+ *  histo.h
+ *
+ *  Fixed-size log-scale histograms of durations. Bucket b
+ *  counts the samples of [2^b, 2^(b+1)) microseconds, so
+ *  adding a sample is a few shifts and the percentiles
+ *  are exact to a factor of two, which is enough to see
+ *  how much of a period a task really needs.
+ *********************************************************/
+#ifndef HISTO_H
+#define HISTO_H
+
+#include "timing.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define HISTO_BUCKETS 32  // up to 2^32 us, more than an hour
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct histo {
+    unsigned long count;
+    nsec_t min;
+    nsec_t max;
+    nsec_t sum;
+    unsigned long buckets[HISTO_BUCKETS];
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+void histo_add(struct histo *h, nsec_t t);
+nsec_t histo_mean(const struct histo *h);
+nsec_t histo_percentile(const struct histo *h, int pct);
+void histo_print_header(const char *title);
+void histo_print(const char *name, const struct histo *h);
+
+#endif
@@ -0,0 +1,406 @@
+/**********************************************************
+ *  bench.c
+ *
+ *  Benchmark of the four controllers against the physics
+ *  back end. Every controller runs every scenario in
+ *  virtual time, as a child process started from the
+ *  directory of this program:
+ *
+ *    build/bench [-o file] [-s scenario] [-t seconds]
+ *
+ *  The bus load, the frame utilization and the time from a
+ *  bus fault to the brake of the emergency mode come from
+ *  the trace of the run (-T), the other reactions of the
+ *  wagon from the SIM lines of the back end and the CPU
+ *  time from the resource usage of the child. Every run
+ *  is a row of the table printed and of the CSV file
+ *  (bench.csv by default); a field that does not apply is
+ *  left empty.
+ *********************************************************/
+
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "bus.h"
+#include "timing.h"
+#include "trace.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define BENCH_PATH 512
+#define NA -1.0  // measure that does not apply to the run
+
+// EMERGENCY_MODE of controllerD.c, the only one with it
+#define BENCH_EMERGENCY_MODE 3
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct bench_controller {
+    const char *name;
+    int cycle_sec;  // TIME_CYCLE_SEC of the controller
+};
+
+struct bench_scenario {
+    const char *name;
+    int seconds;    // long enough for what the scenario tests
+};
+
+struct bench_result {
+    unsigned long frames;
+    unsigned long transactions;
+    unsigned long bytes;
+    double cpu_us;             // per frame
+    double util_mean;          // % of the frame on the bus
+    double util_max;
+    double lamp_latency;       // s from dark to lamps on, worst
+    double stop_time;          // s, mode 1 -> 2
+    double stop_speed;         // m/s at the stop
+    double stop_past;          // m past the station
+    double emergency_reaction; // s from the bus fault to the brake applied
+    int status;                // of the controller
+    // state of the parser
+    double dark_time;
+    double fault_time;
+};
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static const struct bench_controller controllers[] = {
+    {"A", 10},
+    {"B", 5},
+    {"C", 5},
+    {"D", 5},
+};
+#define NUM_CONTROLLERS (sizeof(controllers) / sizeof(controllers[0]))
+
+// The built-in scenarios of sim_physics.c
+static const struct bench_scenario scenarios[] = {
+    {"cruise", 600},
+    {"approach", 5000},
+    {"tunnel", 120},
+    {"hills", 120},
+    {"fault", 120},
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/**********************************************************
+ *  Function: bench_parse
+ *
+ *  Takes the measures of the wagon from a SIM line.
+ *********************************************************/
+static void bench_parse(const char *line, struct bench_result *res)
+{
+    char name[16];
+    double t, value;
+    int from, to, level;
+
+    if (3 == sscanf(line, "SIM %lf s: input %15s %d", &t, name, &level)) {
+        if (strcmp(name, "bus") == 0 && level == 0 && res->fault_time < 0)
+            res->fault_time = t;
+    } else if (2 == sscanf(line, "SIM %lf s: dark %d", &t, &level)) {
+        res->dark_time = level ? t : NA;
+    } else if (2 == sscanf(line, "SIM %lf s: lamps %d", &t, &level)) {
+        if (level && res->dark_time >= 0) {
+            if (t - res->dark_time > res->lamp_latency)
+                res->lamp_latency = t - res->dark_time;
+            res->dark_time = NA;
+        }
+    } else if (4 == sscanf(line, "SIM %lf s: mode %d -> %d, speed %lf",
+                           &t, &from, &to, &value)) {
+        if (from == 1 && to == 2 && res->stop_time < 0) {
+            res->stop_time = t;
+            res->stop_speed = value;
+        }
+    } else if (2 == sscanf(line, "SIM %lf s: stop %lf m past", &t, &value)) {
+        if (res->stop_past < 0)
+            res->stop_past = value;
+    }
+}
+
+/**********************************************************
+ *  Function: bench_brakes
+ *
+ *  Whether r is a brake command the slave acknowledged.
+ *********************************************************/
+static int bench_brakes(const struct trace_record *r)
+{
+    if (r->cmd != BUS_BRK_SET && !(r->cmd == BUS_ACT && r->request[6] == '1'))
+        return 0;
+    return r->answer_len >= MSG_LEN &&
+           memcmp(r->answer + 3, ":  OK", 5) == 0;
+}
+
+/**********************************************************
+ *  Function: bench_trace
+ *
+ *  Counts the exchanges and bytes of the trace at path and
+ *  the time each frame of cycle_ns spends on the bus. After
+ *  a bus fault, finds the first brake the emergency mode
+ *  got through. Returns -1 if the trace cannot be read.
+ *********************************************************/
+static int bench_trace(const char *path, nsec_t cycle_ns,
+                       struct bench_result *res)
+{
+    struct trace_header header;
+    struct trace_record r;
+    nsec_t *busy, max = 0, sum = 0;
+    unsigned long frame;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL)
+        return -1;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(struct trace_record)) {
+        fclose(f);
+        return -1;
+    }
+    busy = calloc(res->frames + 1, sizeof(nsec_t));
+    if (busy == NULL) {
+        fclose(f);
+        return -1;
+    }
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        res->transactions++;
+        res->bytes += r.request_len + r.answer_len;
+        frame = (unsigned long)(r.start / cycle_ns);
+        if (frame <= res->frames)
+            busy[frame] += (nsec_t)r.latency * 1000;
+        if (res->fault_time >= 0 && res->emergency_reaction < 0 &&
+            r.mode == BENCH_EMERGENCY_MODE &&
+            r.start >= (nsec_t)(res->fault_time * NS_PER_S) &&
+            bench_brakes(&r))
+            res->emergency_reaction = (double)(r.start + (nsec_t)r.latency
+                                      * 1000) / NS_PER_S - res->fault_time;
+    }
+    fclose(f);
+
+    for (frame = 0; frame < res->frames; frame++) {
+        sum += busy[frame];
+        if (busy[frame] > max)
+            max = busy[frame];
+    }
+    free(busy);
+    if (res->frames > 0) {
+        res->util_mean = 100.0 * sum / ((double)cycle_ns * res->frames);
+        res->util_max = 100.0 * max / (double)cycle_ns;
+    }
+    return 0;
+}
+
+/**********************************************************
+ *  Function: bench_run
+ *
+ *  Runs the controller of dir against the scenario for
+ *  seconds of virtual time. Returns -1 if it cannot start.
+ *********************************************************/
+static int bench_run(const char *dir, const struct bench_controller *c,
+                     const struct bench_scenario *s, int seconds,
+                     struct bench_result *res)
+{
+    char program[2 * BENCH_PATH], trace[2 * BENCH_PATH];
+    char spec[64], run_time[16], line[256];
+    struct rusage usage;
+    FILE *out;
+    pid_t pid;
+    int fds[2];
+
+    snprintf(program, sizeof(program), "%s/controller%s", dir, c->name);
+    snprintf(trace, sizeof(trace), "%s/bench-%s-%s.trc", dir, c->name,
+             s->name);
+    snprintf(spec, sizeof(spec), "physics:%s", s->name);
+    snprintf(run_time, sizeof(run_time), "%d", seconds);
+
+    memset(res, 0, sizeof(*res));
+    res->lamp_latency = res->stop_time = res->stop_speed = NA;
+    res->stop_past = res->emergency_reaction = NA;
+    res->dark_time = res->fault_time = NA;
+    res->frames = seconds / c->cycle_sec;
+
+    if (pipe(fds) != 0)
+        return -1;
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(program, program, "-s", spec, "-V", "-t", run_time,
+              "-T", trace, (char *)NULL);
+        printf("bench: cannot run %s\n", program);
+        _exit(127);
+    }
+    close(fds[1]);
+    out = fdopen(fds[0], "r");
+    while (fgets(line, sizeof(line), out) != NULL)
+        bench_parse(line, res);
+    fclose(out);
+    wait4(pid, &res->status, 0, &usage);
+    res->status = WIFEXITED(res->status) ? WEXITSTATUS(res->status) : -1;
+
+    res->cpu_us = ((double)usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec +
+                   (double)usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec)
+                  / (res->frames ? res->frames : 1);
+    if (bench_trace(trace, (nsec_t)c->cycle_sec * NS_PER_S, res) != 0)
+        printf("bench: no trace of controller%s %s\n", c->name, s->name);
+    unlink(trace);
+    return 0;
+}
+
+/**********************************************************
+ *  Function: bench_field
+ *
+ *  Prints value, or nothing if it does not apply.
+ *********************************************************/
+static void bench_field(FILE *f, double value)
+{
+    if (value >= 0)
+        fprintf(f, ",%.3f", value);
+    else
+        fprintf(f, ",");
+}
+
+/**********************************************************
+ *  Function: bench_write
+ *
+ *  One CSV row per run.
+ *********************************************************/
+static void bench_write(FILE *f, const struct bench_controller *c,
+                        const struct bench_scenario *s, int seconds,
+                        const struct bench_result *res)
+{
+    double minutes = seconds / 60.0;
+
+    fprintf(f, "%s,%s,%d,%d,%lu", c->name, s->name, seconds, res->status,
+            res->frames);
+    bench_field(f, res->transactions / minutes);
+    bench_field(f, res->bytes / minutes);
+    bench_field(f, res->cpu_us);
+    bench_field(f, res->util_mean);
+    bench_field(f, res->util_max);
+    bench_field(f, res->lamp_latency);
+    bench_field(f, res->stop_time);
+    bench_field(f, res->stop_speed);
+    bench_field(f, res->stop_past);
+    bench_field(f, res->emergency_reaction);
+    fprintf(f, "\n");
+}
+
+/**********************************************************
+ *  Function: bench_print
+ *
+ *  One row of the table of the console.
+ *********************************************************/
+static void bench_print(const struct bench_controller *c,
+                        const struct bench_scenario *s, int seconds,
+                        const struct bench_result *res)
+{
+    double minutes = seconds / 60.0;
+
+    printf("%-4s %-9s %6.1f %7.0f %8.1f %5.1f %5.1f", c->name, s->name,
+           res->transactions / minutes, res->bytes / minutes, res->cpu_us,
+           res->util_mean, res->util_max);
+    if (res->lamp_latency >= 0)
+        printf(" %6.1f", res->lamp_latency);
+    else
+        printf(" %6s", "-");
+    if (res->stop_time >= 0)
+        printf(" %7.1f %5.1f", res->stop_time, res->stop_speed);
+    else
+        printf(" %7s %5s", "-", "-");
+    if (res->stop_past >= 0)
+        printf(" %6.2f", res->stop_past);
+    else
+        printf(" %6s", "-");
+    if (res->emergency_reaction >= 0)
+        printf(" %6.1f", res->emergency_reaction);
+    else
+        printf(" %6s", "-");
+    printf("%s\n", res->status ? "  (failed)" : "");
+}
+
+/**********************************************************
+ *  Function: main
+ *********************************************************/
+int main(int argc, char **argv)
+{
+    const char *output = "bench.csv";
+    const char *only = NULL;
+    char dir[BENCH_PATH];
+    struct bench_result res;
+    unsigned int i, j;
+    int opt, seconds = 0;
+    char *slash;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "o:s:t:")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 's':
+                only = optarg;
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            default:
+                printf("usage: %s [-o file] [-s scenario] [-t seconds]\n",
+                       argv[0]);
+                return 1;
+        }
+    }
+
+    // The controllers are next to this program
+    snprintf(dir, sizeof(dir), "%s", argv[0]);
+    slash = strrchr(dir, '/');
+    if (slash != NULL)
+        *slash = '\0';
+    else
+        snprintf(dir, sizeof(dir), ".");
+
+    f = fopen(output, "w");
+    if (f == NULL) {
+        printf("bench: cannot create %s\n", output);
+        return 1;
+    }
+    fprintf(f, "controller,scenario,seconds,status,frames,"
+               "transactions_per_min,bytes_per_min,cpu_us_per_frame,"
+               "frame_util_mean_pct,frame_util_max_pct,lamp_latency_s,"
+               "stop_time_s,stop_speed_mps,stop_past_m,"
+               "emergency_reaction_s\n");
+    printf("ctrl scenario   trn/min byte/min  cpu(us) util%%  max%%  "
+           "lamp(s) stop(s) speed past(m) emg(s)\n");
+
+    for (j = 0; j < NUM_SCENARIOS; j++) {
+        if (only != NULL && strcmp(only, scenarios[j].name) != 0)
+            continue;
+        for (i = 0; i < NUM_CONTROLLERS; i++) {
+            int run = seconds > 0 ? seconds : scenarios[j].seconds;
+            if (bench_run(dir, &controllers[i], &scenarios[j], run,
+                          &res) != 0) {
+                printf("bench: cannot start controller%s\n",
+                       controllers[i].name);
+                fclose(f);
+                return 1;
+            }
+            bench_write(f, &controllers[i], &scenarios[j], run, &res);
+            bench_print(&controllers[i], &scenarios[j], run, &res);
+        }
+    }
+    fclose(f);
+    printf("Results in %s\n", output);
+    return 0;
+}
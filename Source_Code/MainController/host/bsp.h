@@ -0,0 +1,9 @@
+/**********************************************************
+ *  bsp.h (host)
+ *
+ *  No board support on the host.
+ *********************************************************/
+#ifndef HOST_BSP_H
+#define HOST_BSP_H
+
+#endif
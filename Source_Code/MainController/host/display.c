@@ -0,0 +1,95 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+
+#include "display.h"
+#include "host.h"
+
+/**********************************************************
+ *  Function: displayInit
+ *********************************************************/
+void displayInit(int signal)
+{
+}
+
+/**********************************************************
+ *  Function: displaySpeed
+ *********************************************************/
+void displaySpeed(float speed)
+{
+    if (host_verbose)
+        printf("[display] speed %.1f\n", speed);
+}
+
+/**********************************************************
+ *  Function: displaySlope
+ *********************************************************/
+void displaySlope(int slope)
+{
+    if (host_verbose)
+        printf("[display] slope %d\n", slope);
+}
+
+/**********************************************************
+ *  Function: displayGas
+ *********************************************************/
+void displayGas(int gas)
+{
+    if (host_verbose)
+        printf("[display] gas %d\n", gas);
+}
+
+/**********************************************************
+ *  Function: displayBrake
+ *********************************************************/
+void displayBrake(int brake)
+{
+    if (host_verbose)
+        printf("[display] brake %d\n", brake);
+}
+
+/**********************************************************
+ *  Function: displayMix
+ *********************************************************/
+void displayMix(int mix)
+{
+    if (host_verbose)
+        printf("[display] mixer %d\n", mix);
+}
+
+/**********************************************************
+ *  Function: displayLightSensor
+ *********************************************************/
+void displayLightSensor(int dark)
+{
+    if (host_verbose)
+        printf("[display] dark %d\n", dark);
+}
+
+/**********************************************************
+ *  Function: displayLamps
+ *********************************************************/
+void displayLamps(int lamps)
+{
+    if (host_verbose)
+        printf("[display] lamps %d\n", lamps);
+}
+
+/**********************************************************
+ *  Function: displayStop
+ *********************************************************/
+void displayStop(int stop)
+{
+    if (host_verbose)
+        printf("[display] stop %d\n", stop);
+}
+
+/**********************************************************
+ *  Function: displayDistance
+ *********************************************************/
+void displayDistance(int distance)
+{
+    if (host_verbose)
+        printf("[display] distance %d\n", distance);
+}
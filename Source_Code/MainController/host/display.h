@@ -0,0 +1,21 @@
+/**********************************************************
+ *  display.h (host)
+ *
+ *  Console version of the display of the wagon. Every
+ *  change is printed when the controller runs with -v.
+ *********************************************************/
+#ifndef HOST_DISPLAY_H
+#define HOST_DISPLAY_H
+
+void displayInit(int signal);
+void displaySpeed(float speed);
+void displaySlope(int slope);
+void displayGas(int gas);
+void displayBrake(int brake);
+void displayMix(int mix);
+void displayLightSensor(int dark);
+void displayLamps(int lamps);
+void displayStop(int stop);
+void displayDistance(int distance);
+
+#endif
@@ -0,0 +1,4 @@
+/**********************************************************
+ *  displayA.h (host)
+ *********************************************************/
+#include "display.h"
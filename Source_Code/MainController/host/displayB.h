@@ -0,0 +1,4 @@
+/**********************************************************
+ *  displayB.h (host)
+ *********************************************************/
+#include "display.h"
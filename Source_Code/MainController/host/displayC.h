@@ -0,0 +1,4 @@
+/**********************************************************
+ *  displayC.h (host)
+ *********************************************************/
+#include "display.h"
@@ -0,0 +1,4 @@
+/**********************************************************
+ *  displayD.h (host)
+ *********************************************************/
+#include "display.h"
@@ -0,0 +1,98 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "host.h"
+#include "sim.h"
+#include "timing.h"
+#include "trace.h"
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+int host_verbose = 0;
+static nsec_t run_time = 0;
+static int use_virtual = 0;
+
+/**********************************************************
+ *  Function: host_usage
+ *********************************************************/
+static void host_usage(const char *name)
+{
+    printf("usage: %s [-r seconds] [-s backend[:arg]] [-t seconds] [-T file] [-v] [-V]\n", name);
+    sim_list();
+    exit(1);
+}
+
+/**********************************************************
+ *  Function: host_stop
+ *
+ *  Ends the process after the run time given with -t.
+ *********************************************************/
+static void *host_stop(void *arg)
+{
+    time_sleep(run_time);
+    exit(0);
+    return NULL;
+}
+
+/**********************************************************
+ *  Function: host_at_limit
+ *
+ *  Ends the process when virtual time reaches the run time.
+ *********************************************************/
+static void host_at_limit()
+{
+    exit(0);
+}
+
+/**********************************************************
+ *  Function: host_init
+ *********************************************************/
+void host_init(int argc, char **argv)
+{
+    const char *backend = "static";
+    pthread_t thread;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:s:t:T:vV")) != -1) {
+        switch (opt) {
+            case 'r':
+                bus_set_refresh((nsec_t)(atof(optarg) * NS_PER_S));
+                break;
+            case 's':
+                backend = optarg;
+                break;
+            case 't':
+                run_time = (nsec_t)(atof(optarg) * NS_PER_S);
+                break;
+            case 'T':
+                trace_set_file(optarg);
+                break;
+            case 'v':
+                host_verbose = 1;
+                break;
+            case 'V':
+                use_virtual = 1;
+                break;
+            default:
+                host_usage(argv[0]);
+        }
+    }
+    // Before the back end reads the clock
+    if (use_virtual)
+        time_use_virtual(run_time, host_at_limit);
+    if (sim_select(backend) != 0)
+        host_usage(argv[0]);
+
+    // Line buffered, so the reports can be piped while running
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (run_time > 0 && !use_virtual)
+        pthread_create(&thread, NULL, host_stop, NULL);
+}
@@ -0,0 +1,29 @@
+/**********************************************************
+ *  host.h
+ *
+ *  Options of the Linux build of the main controllers.
+ *
+ *    -r seconds        resend an unchanged actuator command
+ *                      after seconds (0 always sends it)
+ *    -s backend[:arg]  simulator back end (default static)
+ *    -t seconds        stop after seconds of run time
+ *    -T file           record every bus exchange in file
+ *                      (trace.h)
+ *    -v                print every display change
+ *    -V                run in virtual time, as fast as the
+ *                      simulator answers (cyclic builds only)
+ *********************************************************/
+#ifndef HOST_H
+#define HOST_H
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+extern int host_verbose;
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+void host_init(int argc, char **argv);
+
+#endif
@@ -0,0 +1,17 @@
+/**********************************************************
+ *  rtems.h (host)
+ *
+ *  Just enough of RTEMS for the controllers to build and
+ *  run as Linux processes: the type of the Init task.
+ *********************************************************/
+#ifndef HOST_RTEMS_H
+#define HOST_RTEMS_H
+
+#include <stdint.h>
+
+typedef void rtems_task;
+typedef uintptr_t rtems_task_argument;
+
+rtems_task Init(rtems_task_argument ignored);
+
+#endif
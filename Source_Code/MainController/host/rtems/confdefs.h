@@ -0,0 +1,22 @@
+/**********************************************************
+ *  rtems/confdefs.h (host)
+ *
+ *  The RTEMS configuration is ignored on the host; with
+ *  CONFIGURE_INIT it provides the main() that parses the
+ *  host options and runs the Init task.
+ *********************************************************/
+#ifndef HOST_CONFDEFS_H
+#define HOST_CONFDEFS_H
+
+#ifdef CONFIGURE_INIT
+#include "host.h"
+
+int main(int argc, char **argv)
+{
+    host_init(argc, argv);
+    Init(0);
+    return 0;
+}
+#endif
+
+#endif
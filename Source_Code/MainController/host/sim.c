@@ -0,0 +1,88 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+extern const struct sim_backend sim_static;
+extern const struct sim_backend sim_physics;
+extern const struct sim_backend sim_replay;
+
+static const struct sim_backend *backends[] = {
+    &sim_static,
+    &sim_physics,
+    &sim_replay,
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const struct sim_backend *backend = NULL;
+
+/**********************************************************
+ *  Function: sim_select
+ *
+ *  Selects and initialises the back end named by spec,
+ *  "name" or "name:arg". Returns -1 if there is none.
+ *********************************************************/
+int sim_select(const char *spec)
+{
+    const char *arg = strchr(spec, ':');
+    size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+    unsigned int i;
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (strlen(backends[i]->name) != len ||
+            strncmp(backends[i]->name, spec, len) != 0)
+            continue;
+        if (backends[i]->init && backends[i]->init(arg ? arg + 1 : NULL) != 0)
+            return -1;
+        backend = backends[i];
+        return 0;
+    }
+    printf("Unknown simulator back end %s\n", spec);
+    return -1;
+}
+
+/**********************************************************
+ *  Function: sim_list
+ *********************************************************/
+void sim_list()
+{
+    unsigned int i;
+    printf("simulator back ends:\n");
+    for (i = 0; i < NUM_BACKENDS; i++)
+        printf("  %-10s %s\n", backends[i]->name, backends[i]->help);
+}
+
+/**********************************************************
+ *  Function: simulator
+ *********************************************************/
+void simulator(char *request, char *answer)
+{
+    backend->exchange(request, answer);
+}
+
+/**********************************************************
+ *  Function: simulator_send
+ *********************************************************/
+void simulator_send(const char *request)
+{
+    if (backend->send)
+        backend->send(request);
+}
+
+/**********************************************************
+ *  Function: simulator_receive
+ *
+ *  Nothing, as from a silent slave, if the back end does
+ *  not pipeline.
+ *********************************************************/
+void simulator_receive(char *answer)
+{
+    if (backend->receive)
+        backend->receive(answer);
+}
@@ -0,0 +1,38 @@
+/**********************************************************
+ *  sim.h
+ *
+ *  Pluggable back ends of simulator(), the function the
+ *  bus layer calls instead of the I2C driver when
+ *  RASPBERRYPI is not defined. A back end gets each
+ *  request frame and writes the answer the Arduino would
+ *  send, '\n' terminated.
+ *
+ *  A back end that advertises BUS_CAP_PIPELINE also takes
+ *  the requests and gives the answers separately, so the
+ *  master can queue several requests before reading.
+ *********************************************************/
+#ifndef SIM_H
+#define SIM_H
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct sim_backend {
+    const char *name;
+    const char *help;
+    int (*init)(const char *arg);  // arg after the ':', or NULL
+    void (*exchange)(const char *request, char *answer);
+    void (*send)(const char *request);  // NULL if not pipelining
+    void (*receive)(char *answer);
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+int sim_select(const char *spec);
+void sim_list();
+void simulator(char *request, char *answer);
+void simulator_send(const char *request);
+void simulator_receive(char *answer);
+
+#endif
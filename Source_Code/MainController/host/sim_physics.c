@@ -0,0 +1,684 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bus.h"
+#include "sim.h"
+#include "timing.h"
+#include "wagon_fixed.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+// Same values as arduino_codeD.ino
+#define MESSAGE_SIZE 8
+#define LONG_MESSAGE_SIZE 16
+#define CAP_COMPOUND 0x0001
+#define CAP_READY_POLL 0x0002
+#define CAP_REGISTERS 0x0004
+#define CAP_PIPELINE 0x0008
+#define FIFO_SLOTS 4
+
+// Period of the Arduino loop
+#define TICK_NS (200 * NS_PER_MS)
+
+// Inputs of the wagon a scenario can change
+#define IN_UP     0  // slope switch, pin 9
+#define IN_DOWN   1  // slope switch, pin 8
+#define IN_BUTTON 2  // distance button, pin 6
+#define IN_LDR    3  // light sensor, A0 (0-1023)
+#define IN_POT    4  // distance potentiometer, A1 (0-1023)
+#define IN_BUS    5  // 0 disconnects the I2C bus
+#define NUM_INPUTS 6
+
+#define MAX_EVENTS 64
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct sim_event {
+    double time;  // seconds from the start
+    int input;
+    int value;
+};
+
+// Queued request, as in the Arduino
+struct slot {
+    char request[MESSAGE_SIZE+1];
+    char answer[LONG_MESSAGE_SIZE+1];
+    int answer_size;
+    int ready;
+};
+
+struct scenario {
+    const char *name;
+    const char *help;
+    struct sim_event events[MAX_EVENTS];
+};
+
+/**********************************************************
+ *  Scenarios
+ *********************************************************/
+static const char *input_names[NUM_INPUTS] = {
+    "up", "down", "button", "ldr", "pot", "bus"
+};
+
+// Daylight is ldr 900 (light 91%), a tunnel ldr 200 (15%). The
+// potentiometer gives 10000 m at 511 and 20000 m at 575.
+static const struct scenario scenarios[] = {
+    {"cruise", "flat, daylight, no station selected", {
+        {0, -1, 0}}},
+    {"approach", "select 20000 m and approach the station until it stops", {
+        {2.0, IN_POT, 575},
+        {5.0, IN_BUTTON, 1},
+        {5.4, IN_BUTTON, 0},
+        {0, -1, 0}}},
+    {"tunnel", "a tunnel between 30 s and 60 s", {
+        {30.0, IN_LDR, 200},
+        {60.0, IN_LDR, 900},
+        {0, -1, 0}}},
+    {"hills", "up at 10 s, flat at 40 s, down at 60 s, flat at 90 s", {
+        {10.0, IN_UP, 1},
+        {40.0, IN_UP, 0},
+        {60.0, IN_DOWN, 1},
+        {90.0, IN_DOWN, 0},
+        {0, -1, 0}}},
+    {"fault", "the bus fails between 20 s and 25 s", {
+        {20.0, IN_BUS, 0},
+        {25.0, IN_BUS, 1},
+        {0, -1, 0}}},
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+// Scenario
+static struct scenario file_scenario;
+static const struct scenario *scenario;
+static int next_event;
+static int inputs[NUM_INPUTS];
+
+// Virtual Arduino, named as in arduino_codeD.ino
+static int started;
+static nsec_t start_time;
+static nsec_t next_tick;
+static long speed;               // mm/s
+static long speed_rem;
+static unsigned long elapsedTime;  // ms
+static int acc_slope;             // mm/s2
+static int acc;                   // mm/s2
+static int lamps;
+static char dis_value[7];
+static long selected_distance;   // mm
+static long act_distance;        // mm
+static long distance_rem;
+static int lastButtonState;
+static int lastButtonStateStop;
+static int CURRENT_MODE;
+static int slope_up;
+static int slope_down;
+static int led_mix;
+static int led_lamp;
+static int was_dark;              // of the last pass, for the reports
+static int was_lamp;
+static struct slot fifo[FIFO_SLOTS];
+static unsigned int fifo_head;
+static unsigned int fifo_run;
+static unsigned int fifo_tail;
+static struct slot *current;
+
+static struct {
+    char spd[MESSAGE_SIZE+2];
+    char slp[MESSAGE_SIZE+2];
+    char lit[MESSAGE_SIZE+2];
+    char ds[MESSAGE_SIZE+2];
+    char stp[MESSAGE_SIZE+2];
+    char sns[LONG_MESSAGE_SIZE+1];
+    char cap[MESSAGE_SIZE+2];
+    unsigned char regs[BUS_REG_SIZE];
+} snap;
+
+/**********************************************************
+ *  Function: constrain
+ *********************************************************/
+static long constrain(long value, long low, long high)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+/**********************************************************
+ *  Function: speed_req
+ *********************************************************/
+static void speed_req()
+{
+    if (CURRENT_MODE == 3 && speed <= 0) {
+        speed = 0;
+        speed_rem = 0;
+    } else if (CURRENT_MODE != 2) {
+        elapsedTime = TICK_NS / NS_PER_MS;
+        speed = fx_speed_step(speed, acc + acc_slope, elapsedTime, &speed_rem);
+    } else {
+        speed = 0;
+        speed_rem = 0;
+    }
+}
+
+/**********************************************************
+ *  Function: slope_req
+ *********************************************************/
+static void slope_req()
+{
+    int up = inputs[IN_UP];
+    int down = inputs[IN_DOWN];
+
+    if (up && !down) acc_slope = FX_ACC_UP;
+    else if (!up && down) acc_slope = FX_ACC_DOWN;
+    else if (!down && !up) acc_slope = FX_ACC_FLAT;
+    slope_up = up;
+    slope_down = down;
+}
+
+/**********************************************************
+ *  Function: reply
+ *
+ *  Answers the current request with text.
+ *********************************************************/
+static void reply(const char *text)
+{
+    snprintf(current->answer, sizeof(current->answer), "%s", text);
+    current->answer_size = MESSAGE_SIZE;
+    current->ready = 1;
+}
+
+/**********************************************************
+ *  Function: command
+ *
+ *  Runs the current request. Emergency mode only serves
+ *  MIX and a command the mode does not serve is refused.
+ *  The LAM quirk of the Arduino (lamp_set also sets acc)
+ *  is kept.
+ *********************************************************/
+static void command(int mode)
+{
+    const char *request = current->request;
+
+    if (mode == 3 && strncmp("MIX: ", request, 5) != 0)
+        reply("MSG: ERR");
+    else if (0 == strcmp("GAS: SET", request)) { acc = FX_ACC; reply("GAS:  OK"); }
+    else if (0 == strcmp("GAS: CLR", request)) { acc = 0; reply("GAS:  OK"); }
+    else if (0 == strcmp("BRK: SET", request)) { acc = FX_BRAKE; reply("BRK:  OK"); }
+    else if (0 == strcmp("BRK: CLR", request)) { acc = 0; reply("BRK:  OK"); }
+    else if (0 == strcmp("MIX: SET", request)) { led_mix = 1; reply("MIX:  OK"); }
+    else if (0 == strcmp("MIX: CLR", request)) { led_mix = 0; reply("MIX:  OK"); }
+    else if (0 == strcmp("LAM: SET", request)) {
+        led_lamp = 1; acc = FX_BRAKE; reply("LAM:  OK");
+    }
+    else if (0 == strcmp("LAM: CLR", request)) {
+        led_lamp = 0; acc = 0; reply("LAM:  OK");
+    }
+    else if (0 == strcmp("ERR: SET", request)) {
+        CURRENT_MODE = 3;
+        reply("ERR:  OK");
+    }
+    else if (0 == strncmp("ACT: ", request, 5)) {
+        // Lamps first, then the clears, then the sets
+        if (request[7] == '1' || request[7] == '0') {
+            led_lamp = request[7] == '1';
+            acc = led_lamp ? FX_BRAKE : 0;
+        }
+        if (request[5] == '0' || request[6] == '0') acc = 0;
+        if (request[5] == '1') acc = FX_ACC;
+        if (request[6] == '1') acc = FX_BRAKE;
+        reply("ACT:  OK");
+    }
+    else
+        reply("MSG: ERR");
+}
+
+/**********************************************************
+ *  Function: commands
+ *
+ *  command_run: every queued command, after the sensors.
+ *********************************************************/
+static void commands(int mode)
+{
+    for (; fifo_run != fifo_head; fifo_run++) {
+        current = &fifo[fifo_run % FIFO_SLOTS];
+        if (!current->ready)
+            command(mode);
+    }
+}
+
+/**********************************************************
+ *  Function: lamps_req
+ *********************************************************/
+static void lamps_req()
+{
+    lamps = fx_range_lamps(inputs[IN_LDR]);
+}
+
+/**********************************************************
+ *  Function: distance_req
+ *********************************************************/
+static void distance_req()
+{
+    selected_distance = fx_range_distance(inputs[IN_POT]);
+    fx_format(dis_value, selected_distance, 4, 0);
+}
+
+/**********************************************************
+ *  Function: distance_val
+ *********************************************************/
+static void distance_val()
+{
+    int buttonState = inputs[IN_BUTTON];
+    if (buttonState != lastButtonState) {
+        CURRENT_MODE = buttonState;
+        act_distance = selected_distance;
+        distance_rem = 0;
+    }
+    lastButtonState = buttonState;
+}
+
+/**********************************************************
+ *  Function: actual_distance
+ *********************************************************/
+static void actual_distance()
+{
+    act_distance -= fx_distance_step(speed, acc + acc_slope, elapsedTime,
+                                     &distance_rem);
+
+    if (act_distance <= 0 && speed <= 10000) {
+        CURRENT_MODE = 2;
+        printf("SIM %7.1f s: stop %.1f m past the station\n",
+               (double)(next_tick - start_time) / NS_PER_S,
+               -act_distance / 1000.0);
+        act_distance = 0;
+    }
+    if (act_distance <= 0 && speed >= 10000) {
+        CURRENT_MODE = 0;
+    }
+    fx_format(dis_value, act_distance, 4, 0);
+}
+
+/**********************************************************
+ *  Function: stop_end
+ *********************************************************/
+static void stop_end()
+{
+    int buttonStateStop = inputs[IN_BUTTON];
+    if (buttonStateStop != lastButtonStateStop) {
+        CURRENT_MODE = 0;
+        speed = 0;
+        speed_rem = 0;
+    }
+    lastButtonStateStop = buttonStateStop;
+}
+
+/**********************************************************
+ *  Function: reg_put
+ *********************************************************/
+static void reg_put(unsigned char *reg, long value, int size)
+{
+    int i;
+    for (i = 0; i < size; i++) {
+        reg[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+/**********************************************************
+ *  Function: snapshot_update
+ *********************************************************/
+static void snapshot_update(int mode)
+{
+    char num_str[16];
+    char slope;
+    long distance;
+
+    fx_format(num_str, speed, 4, 1);
+    snprintf(snap.spd, sizeof(snap.spd), "SPD:%.5s", num_str);
+
+    if (slope_up && !slope_down) sprintf(snap.slp, "SLP:  UP");
+    else if (!slope_up && slope_down) sprintf(snap.slp, "SLP:DOWN");
+    else if (!slope_up && !slope_down) sprintf(snap.slp, "SLP:FLAT");
+    else snap.slp[0] = '\0';
+
+    if (mode != 3) {
+        snprintf(snap.lit, sizeof(snap.lit), "LIT: %3d", lamps);
+    } else {
+        snap.lit[0] = '\0';
+    }
+
+    if (mode == 1) snprintf(snap.ds, sizeof(snap.ds), "DS:%s", dis_value);
+    else snap.ds[0] = '\0';
+
+    if (mode == 2) sprintf(snap.stp, CURRENT_MODE != 2 ? "STP:  GO" : "STP:STOP");
+    else snap.stp[0] = '\0';
+
+    slope = 'F';
+    if (acc_slope == FX_ACC_UP) slope = 'U';
+    else if (acc_slope == FX_ACC_DOWN) slope = 'D';
+    distance = 0;
+    if (CURRENT_MODE == 1) distance = constrain(act_distance/1000, 0L, 99999L);
+    fx_format(num_str, speed, 5, 1);
+    snprintf(snap.sns, sizeof(snap.sns), "SNS%.5s%c%02ld%05ld", num_str, slope,
+             constrain(lamps, 0, 99), distance);
+
+    sprintf(snap.cap, "CAP:%04X",
+            CAP_COMPOUND | CAP_READY_POLL | CAP_REGISTERS | CAP_PIPELINE);
+
+    reg_put(snap.regs + BUS_REG_SPEED,
+            constrain(speed/10, -32768L, 32767L), 2);
+    reg_put(snap.regs + BUS_REG_ACCEL, (long)(acc+acc_slope), 2);
+    snap.regs[BUS_REG_SLOPE] = slope_up ? (slope_down ? 3 : 1)
+                                        : (slope_down ? 2 : 0);
+    snap.regs[BUS_REG_LIGHT] = constrain(lamps, 0, 100);
+    reg_put(snap.regs + BUS_REG_DISTANCE,
+            CURRENT_MODE == 1 ? act_distance : 0L, 4);
+    snap.regs[BUS_REG_MODE] = CURRENT_MODE;
+    snap.regs[BUS_REG_FLAGS] = (acc == FX_ACC ? BUS_FLAG_GAS : 0) |
+                               (acc == FX_BRAKE ? BUS_FLAG_BRK : 0) |
+                               (led_mix ? BUS_FLAG_MIX : 0) |
+                               (led_lamp ? BUS_FLAG_LAM : 0);
+}
+
+/**********************************************************
+ *  Function: tick
+ *
+ *  One pass of the Arduino loop.
+ *********************************************************/
+static void tick()
+{
+    int mode = CURRENT_MODE;
+
+    switch (mode) {
+        case 0:
+            speed_req(); slope_req(); lamps_req();
+            distance_req(); distance_val();
+            break;
+        case 1:
+            speed_req(); slope_req(); lamps_req(); actual_distance();
+            break;
+        case 2:
+            speed_req(); slope_req(); lamps_req(); stop_end();
+            break;
+        case 3:
+            // acc_emg_req, brk_emg_req, lamp_emg_led
+            acc = FX_BRAKE;
+            speed_req(); slope_req();
+            led_lamp = 1;
+            break;
+    }
+    commands(mode);
+    snapshot_update(mode);
+
+    if (CURRENT_MODE != mode)
+        printf("SIM %7.1f s: mode %d -> %d, speed %.1f, distance %.0f\n",
+               (double)(next_tick - start_time) / NS_PER_S, mode,
+               CURRENT_MODE, speed / 1000.0, act_distance / 1000.0);
+    // Below 50% of light the controllers want the lamps on
+    if ((lamps < 50) != was_dark) {
+        was_dark = lamps < 50;
+        printf("SIM %7.1f s: dark %d\n",
+               (double)(next_tick - start_time) / NS_PER_S, was_dark);
+    }
+    if (led_lamp != was_lamp) {
+        was_lamp = led_lamp;
+        printf("SIM %7.1f s: lamps %d\n",
+               (double)(next_tick - start_time) / NS_PER_S, led_lamp);
+    }
+}
+
+/**********************************************************
+ *  Function: run_until
+ *
+ *  Applies the scenario and runs the loop up to now.
+ *********************************************************/
+static void run_until(nsec_t now)
+{
+    const struct sim_event *ev;
+
+    while (next_tick <= now) {
+        for (ev = &scenario->events[next_event];
+             ev->input >= 0 &&
+             start_time + (nsec_t)(ev->time * NS_PER_S) <= next_tick;
+             ev++, next_event++) {
+            inputs[ev->input] = ev->value;
+            printf("SIM %7.1f s: input %s %d\n",
+                   (double)(next_tick - start_time) / NS_PER_S,
+                   input_names[ev->input], ev->value);
+        }
+        tick();
+        next_tick += TICK_NS;
+    }
+}
+
+/**********************************************************
+ *  Function: load_scenario
+ *
+ *  Reads lines "seconds input value" from path.
+ *********************************************************/
+static int load_scenario(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128], name[16];
+    struct sim_event *ev = file_scenario.events;
+    int i;
+
+    if (f == NULL) {
+        printf("physics: unknown scenario %s\n", path);
+        return -1;
+    }
+    file_scenario.name = path;
+    while (fgets(line, sizeof(line), f) != NULL &&
+           ev < &file_scenario.events[MAX_EVENTS-1]) {
+        if (line[0] == '#' ||
+            3 != sscanf(line, "%lf %15s %d", &ev->time, name, &ev->value))
+            continue;
+        for (i = 0; i < NUM_INPUTS && strcmp(name, input_names[i]); i++)
+            ;
+        if (i == NUM_INPUTS) {
+            printf("physics: unknown input %s\n", name);
+            fclose(f);
+            return -1;
+        }
+        ev->input = i;
+        ev++;
+    }
+    ev->input = -1;
+    fclose(f);
+    scenario = &file_scenario;
+    return 0;
+}
+
+/**********************************************************
+ *  Function: physics_summary
+ *********************************************************/
+static void physics_summary()
+{
+    printf("SIM %7.1f s: end in mode %d, speed %.1f, distance %.0f, "
+           "lamps %d, mixer %d\n",
+           (double)(time_now() - start_time) / NS_PER_S, CURRENT_MODE,
+           speed / 1000.0, act_distance / 1000.0, led_lamp, led_mix);
+}
+
+/**********************************************************
+ *  Function: physics_init
+ *
+ *  arg is a built-in scenario or a scenario file.
+ *********************************************************/
+static int physics_init(const char *arg)
+{
+    unsigned int i;
+
+    scenario = &scenarios[0];
+    if (arg != NULL) {
+        for (i = 0; i < NUM_SCENARIOS; i++)
+            if (0 == strcmp(arg, scenarios[i].name))
+                break;
+        if (i < NUM_SCENARIOS)
+            scenario = &scenarios[i];
+        else if (load_scenario(arg) != 0)
+            return -1;
+    }
+
+    // Initial state of the Arduino and the wagon
+    speed = 55500;
+    speed_rem = distance_rem = 0;
+    acc = acc_slope = 0;
+    elapsedTime = 0;
+    act_distance = selected_distance = 0;
+    lastButtonState = lastButtonStateStop = 0;
+    CURRENT_MODE = 0;
+    led_mix = led_lamp = 0;
+    was_dark = was_lamp = 0;
+    fifo_head = fifo_run = fifo_tail = 0;
+    memset(inputs, 0, sizeof(inputs));
+    inputs[IN_LDR] = 900;
+    inputs[IN_POT] = 511;
+    inputs[IN_BUS] = 1;
+    next_event = 0;
+    strcpy(dis_value, "0");
+    snapshot_update(CURRENT_MODE);
+
+    // The loop runs on its own grid, from the first exchange
+    started = 0;
+    atexit(physics_summary);
+    return 0;
+}
+
+/**********************************************************
+ *  Function: physics_start
+ *
+ *  Runs the loop up to now, on its own grid from the first
+ *  exchange. Returns 0 if the bus is disconnected.
+ *********************************************************/
+static int physics_start()
+{
+    if (!started) {
+        started = 1;
+        start_time = time_now();
+        next_tick = start_time + TICK_NS;
+    }
+    run_until(time_now());
+    return inputs[IN_BUS];
+}
+
+/**********************************************************
+ *  Function: physics_send
+ *
+ *  receiveEvent: queues the request. Read requests are
+ *  answered at once from the snapshot, commands when the
+ *  next loop pass runs them.
+ *********************************************************/
+static void physics_send(const char *frame)
+{
+    const char *value = NULL;
+    struct slot *slot;
+
+    if (!physics_start())
+        return;
+    if (fifo_head - fifo_tail >= FIFO_SLOTS ||
+        fifo_head - fifo_run >= FIFO_SLOTS) {
+        printf("SIM: queue full, %.8s dropped\n", frame);
+        return;
+    }
+
+    slot = &fifo[fifo_head % FIFO_SLOTS];
+    memcpy(slot->request, frame, MESSAGE_SIZE);
+    slot->request[MESSAGE_SIZE] = '\0';
+    slot->answer_size = MESSAGE_SIZE;
+    slot->ready = 0;
+    if (0 == strcmp("SPD: REQ", slot->request)) value = snap.spd;
+    else if (0 == strcmp("SLP: REQ", slot->request)) value = snap.slp;
+    else if (0 == strcmp("LIT: REQ", slot->request)) value = snap.lit;
+    else if (0 == strcmp("DS:  REQ", slot->request)) value = snap.ds;
+    else if (0 == strcmp("STP: REQ", slot->request)) value = snap.stp;
+    else if (0 == strcmp("SNS: REQ", slot->request)) value = snap.sns;
+    else if (0 == strcmp("CAP: REQ", slot->request)) value = snap.cap;
+
+    if (value != NULL) {
+        if (value == snap.sns)
+            slot->answer_size = LONG_MESSAGE_SIZE;
+        if (value[0] == '\0') {
+            value = "MSG: ERR";
+            slot->answer_size = MESSAGE_SIZE;
+        }
+        memset(slot->answer, '\0', sizeof(slot->answer));
+        memcpy(slot->answer, value, strlen(value));
+        slot->ready = 1;
+    }
+    fifo_head++;
+}
+
+/**********************************************************
+ *  Function: physics_receive
+ *
+ *  requestEvent: the answer of the oldest request, once
+ *  the loop has run it, as the master polling MSG:BUSY
+ *  would get it.
+ *********************************************************/
+static void physics_receive(char *out)
+{
+    struct slot *slot;
+
+    if (!physics_start())
+        return;
+    if (fifo_tail == fifo_head) {
+        sprintf(out, "MSG: ERR\n");
+        return;
+    }
+    slot = &fifo[fifo_tail % FIFO_SLOTS];
+    while (!slot->ready) {
+        // Wait for the loop to run the command
+        time_sleep_until(next_tick);
+        run_until(time_now());
+    }
+    memcpy(out, slot->answer, slot->answer_size);
+    out[slot->answer_size] = '\n';
+    fifo_tail++;
+}
+
+/**********************************************************
+ *  Function: physics_exchange
+ *
+ *  A request and its answer. The registers are answered
+ *  at once and not queued.
+ *********************************************************/
+static void physics_exchange(const char *frame, char *out)
+{
+    // Select byte: the registers from there on, at once
+    if ((unsigned char)frame[0] & BUS_REG_SELECT) {
+        int first = (unsigned char)frame[0] & ~BUS_REG_SELECT;
+        if (!physics_start())
+            return;
+        if (first >= BUS_REG_SIZE) {
+            sprintf(out, "MSG: ERR\n");
+            return;
+        }
+        out[0] = frame[0];
+        memcpy(out + 1, snap.regs + first, BUS_REG_SIZE - first);
+        return;
+    }
+
+    physics_send(frame);
+    physics_receive(out);
+}
+
+/**********************************************************
+ *  Back end
+ *********************************************************/
+const struct sim_backend sim_physics = {
+    "physics",
+    "arduino_codeD.ino in closed loop\n"
+    "             [:cruise|approach|tunnel|hills|fault|file]",
+    physics_init,
+    physics_exchange,
+    physics_send,
+    physics_receive,
+};
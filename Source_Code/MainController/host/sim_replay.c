@@ -0,0 +1,294 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bus.h"
+#include "sim.h"
+#include "timing.h"
+#include "trace.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+// Records looked ahead for a request the recording has later,
+// before taking it as one the recorded controller did not send,
+// and how much later than now they may have been recorded
+#define REPLAY_WINDOW 8
+#define REPLAY_SLACK_NS (2 * NS_PER_S)
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+// Answer of a queued request
+struct replay_slot {
+    const struct trace_record *record;  // NULL: none recorded
+};
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static struct trace_record *records = NULL;
+static int num_records = 0;
+static int next = 0;              // next record expected
+static const char *replay_path;
+
+static int started = 0;
+static nsec_t start_time;         // first exchange of the replay
+static nsec_t pipe_start;         // first write of the queued requests
+static struct replay_slot queue[BUS_PIPE_DEPTH];
+static unsigned int queue_head = 0;
+static unsigned int queue_tail = 0;
+
+// Differences with the recording
+static unsigned long matched = 0;
+static unsigned long missing = 0;  // recorded, not sent
+static unsigned long extra = 0;    // sent, not recorded
+static nsec_t shift_max = 0;       // of the requests, against the recording
+static nsec_t shift_sum = 0;
+
+/**********************************************************
+ *  Function: replay_name
+ *
+ *  Printable request of a record.
+ *********************************************************/
+static const char *replay_name(const struct trace_record *r)
+{
+    return r->cmd < BUS_NUM_CMDS ? bus_cmd_name(r->cmd) : "?";
+}
+
+/**********************************************************
+ *  Function: replay_time
+ *
+ *  Seconds since the first exchange of the replay.
+ *********************************************************/
+static double replay_time()
+{
+    return (double)(time_now() - start_time) / NS_PER_S;
+}
+
+/**********************************************************
+ *  Function: replay_same
+ *
+ *  Whether request is the request of record r.
+ *********************************************************/
+static int replay_same(const struct trace_record *r, const char *request)
+{
+    return memcmp(r->request, request, r->request_len) == 0;
+}
+
+/**********************************************************
+ *  Function: replay_summary
+ *********************************************************/
+static void replay_summary()
+{
+    printf("REPLAY %7.1f s: %lu matched, %lu missing, %lu extra, "
+           "%d of %d records left, shift mean %lld ms, max %lld ms\n",
+           started ? replay_time() : 0.0, matched, missing, extra,
+           num_records - next, num_records,
+           (long long)(matched ? shift_sum / (nsec_t)matched / NS_PER_MS : 0),
+           (long long)(shift_max / NS_PER_MS));
+}
+
+/**********************************************************
+ *  Function: replay_match
+ *
+ *  The record that answers request. The recorded requests
+ *  skipped to reach it are missing; a request not found in
+ *  the next REPLAY_WINDOW records, up to REPLAY_SLACK_NS
+ *  past the time of the replay, is extra and gets the
+ *  last answer recorded for it, or none.
+ *********************************************************/
+static const struct trace_record *replay_match(const char *request)
+{
+    const struct trace_record *r;
+    nsec_t shift, limit;
+    int i, last;
+
+    if (!started) {
+        started = 1;
+        start_time = time_now();
+    }
+    if (next == num_records) {
+        printf("REPLAY %7.1f s: end of the recording\n", replay_time());
+        exit(missing || extra ? 1 : 0);
+    }
+
+    limit = records[0].start + (time_now() - start_time) + REPLAY_SLACK_NS;
+    last = next + REPLAY_WINDOW < num_records ? next + REPLAY_WINDOW
+                                              : num_records;
+    for (i = next; i < last && records[i].start <= limit; i++)
+        if (replay_same(&records[i], request))
+            break;
+    if (i == last || records[i].start > limit) {
+        extra++;
+        printf("REPLAY %7.1f s: extra %.8s\n", replay_time(),
+               ((unsigned char)request[0] & BUS_REG_SELECT) ?
+               bus_cmd_name(BUS_REG_READ) : request);
+        for (i = next - 1; i >= 0; i--)
+            if (replay_same(&records[i], request))
+                return &records[i];
+        return NULL;
+    }
+
+    for (; next < i; next++) {
+        missing++;
+        printf("REPLAY %7.1f s: missing %s, recorded at %.1f s in mode %d, "
+               "cycle %u\n", replay_time(), replay_name(&records[next]),
+               (double)(records[next].start - records[0].start) / NS_PER_S,
+               records[next].mode, (unsigned int)records[next].cycle);
+    }
+    r = &records[next++];
+    matched++;
+    shift = (time_now() - start_time) - (r->start - records[0].start);
+    if (shift < 0)
+        shift = -shift;
+    shift_sum += shift;
+    if (shift > shift_max)
+        shift_max = shift;
+    return r;
+}
+
+/**********************************************************
+ *  Function: replay_answer
+ *
+ *  Copies the answer of r, or none for a silent slave.
+ *********************************************************/
+static void replay_answer(const struct trace_record *r, char *answer)
+{
+    if (r == NULL) {
+        sprintf(answer, "MSG: ERR\n");
+        return;
+    }
+    if (r->answer_len == 0)
+        return;
+    memcpy(answer, r->answer, r->answer_len);
+    answer[r->answer_len] = '\n';
+}
+
+/**********************************************************
+ *  Function: replay_init
+ *
+ *  arg is a trace written with -T.
+ *********************************************************/
+static int replay_init(const char *arg)
+{
+    struct trace_header header;
+    FILE *f;
+    int size = 0;
+
+    if (arg == NULL) {
+        printf("replay: no trace given\n");
+        return -1;
+    }
+    f = fopen(arg, "rb");
+    if (f == NULL) {
+        printf("replay: cannot open %s\n", arg);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION ||
+        header.record_size != sizeof(struct trace_record)) {
+        printf("replay: %s is not a trace of this build\n", arg);
+        fclose(f);
+        return -1;
+    }
+
+    num_records = 0;
+    while (1) {
+        if (num_records == size) {
+            size = size ? 2 * size : 1024;
+            records = realloc(records, size * sizeof(struct trace_record));
+            if (records == NULL) {
+                printf("replay: out of memory\n");
+                fclose(f);
+                return -1;
+            }
+        }
+        if (fread(&records[num_records], sizeof(struct trace_record), 1,
+                  f) != 1)
+            break;
+        num_records++;
+    }
+    fclose(f);
+    if (num_records == 0) {
+        printf("replay: %s has no records\n", arg);
+        return -1;
+    }
+
+    replay_path = arg;
+    next = 0;
+    started = 0;
+    queue_head = queue_tail = 0;
+    printf("REPLAY: %d records of %s, %.1f s\n", num_records, replay_path,
+           (double)(records[num_records-1].start - records[0].start)
+           / NS_PER_S);
+    atexit(replay_summary);
+    return 0;
+}
+
+/**********************************************************
+ *  Function: replay_exchange
+ *
+ *  The recorded answer, after the recorded latency.
+ *********************************************************/
+static void replay_exchange(const char *request, char *answer)
+{
+    const struct trace_record *r = replay_match(request);
+
+    if (r != NULL)
+        time_sleep((nsec_t)r->latency * 1000);
+    replay_answer(r, answer);
+}
+
+/**********************************************************
+ *  Function: replay_send
+ *
+ *  Queues the record of a pipelined request. Its recorded
+ *  latency runs from the first write of the queue.
+ *********************************************************/
+static void replay_send(const char *request)
+{
+    const struct trace_record *r = replay_match(request);
+
+    if (queue_head - queue_tail >= BUS_PIPE_DEPTH) {
+        printf("REPLAY: queue full, %.8s dropped\n", request);
+        return;
+    }
+    if (queue_head == queue_tail)
+        pipe_start = time_now();
+    queue[queue_head++ % BUS_PIPE_DEPTH].record = r;
+}
+
+/**********************************************************
+ *  Function: replay_receive
+ *********************************************************/
+static void replay_receive(char *answer)
+{
+    const struct trace_record *r;
+
+    if (queue_tail == queue_head) {
+        sprintf(answer, "MSG: ERR\n");
+        return;
+    }
+    r = queue[queue_tail++ % BUS_PIPE_DEPTH].record;
+    if (r != NULL)
+        time_sleep_until(pipe_start + (nsec_t)r->latency * 1000);
+    replay_answer(r, answer);
+}
+
+/**********************************************************
+ *  Back end
+ *********************************************************/
+const struct sim_backend sim_replay = {
+    "replay",
+    "answers of a trace written with -T, and how the\n"
+    "             requests differ from it [:file]",
+    replay_init,
+    replay_exchange,
+    replay_send,
+    replay_receive,
+};
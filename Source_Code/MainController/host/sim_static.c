@@ -0,0 +1,89 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "bus.h"
+#include "sim.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+// The wagon of the static back end: cruising on the flat,
+// in daylight, far from the next stop
+#define STATIC_SPEED    55.0
+#define STATIC_LIGHT    80
+#define STATIC_DISTANCE 20000
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static int static_caps = 0;
+
+/**********************************************************
+ *  Function: static_init
+ *
+ *  "compound" makes the back end advertise the compound
+ *  SNS/ACT commands.
+ *********************************************************/
+static int static_init(const char *arg)
+{
+    static_caps = 0;
+    if (arg == NULL)
+        return 0;
+    if (strcmp(arg, "compound") == 0) {
+        static_caps = BUS_CAP_COMPOUND;
+        return 0;
+    }
+    printf("static: unknown option %s\n", arg);
+    return -1;
+}
+
+/**********************************************************
+ *  Function: static_exchange
+ *
+ *  Answers like an Arduino that never changes state.
+ *********************************************************/
+static void static_exchange(const char *request, char *answer)
+{
+    if (0 == strncmp(request, "SPD: REQ", MSG_LEN))
+        sprintf(answer, "SPD:%4.1f\n", STATIC_SPEED);
+    else if (0 == strncmp(request, "SLP: REQ", MSG_LEN))
+        sprintf(answer, "SLP:FLAT\n");
+    else if (0 == strncmp(request, "LIT: REQ", MSG_LEN))
+        sprintf(answer, "LIT: %3d\n", STATIC_LIGHT);
+    else if (0 == strncmp(request, "DS:  REQ", MSG_LEN))
+        sprintf(answer, "DS:%5d\n", STATIC_DISTANCE);
+    else if (0 == strncmp(request, "STP: REQ", MSG_LEN))
+        sprintf(answer, "STP:  GO\n");
+    else if (0 == strncmp(request, "CAP: REQ", MSG_LEN) && static_caps)
+        sprintf(answer, "CAP:%04X\n", static_caps);
+    else if (0 == strncmp(request, "SNS: REQ", MSG_LEN) && static_caps)
+        sprintf(answer, "SNS%5.1fF%02d%05d\n", STATIC_SPEED,
+                STATIC_LIGHT, STATIC_DISTANCE);
+    else if (0 == strncmp(request, "ACT: ", 5) && static_caps)
+        sprintf(answer, "ACT:  OK\n");
+    else if (0 == strncmp(request, "GAS: ", 5) ||
+             0 == strncmp(request, "BRK: ", 5) ||
+             0 == strncmp(request, "MIX: ", 5) ||
+             0 == strncmp(request, "LAM: ", 5) ||
+             0 == strncmp(request, "ERR: SET", MSG_LEN)) {
+        memcpy(answer, request, 3);
+        sprintf(answer + 3, ":  OK\n");
+    }
+    else
+        sprintf(answer, "MSG: ERR\n");
+}
+
+/**********************************************************
+ *  Back end
+ *********************************************************/
+const struct sim_backend sim_static = {
+    "static",
+    "constant speed, flat, daylight, far away [:compound]",
+    static_init,
+    static_exchange,
+    NULL,
+    NULL,
+};
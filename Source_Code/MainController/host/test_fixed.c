@@ -0,0 +1,224 @@
+/**********************************************************
+ *  test_fixed.c
+ *
+ *  Checks the fixed-point arithmetic of wagon_fixed.h
+ *  against the double formulas of the original
+ *  arduino_codeD.ino:
+ *
+ *    make test
+ *
+ *  The integrator runs TEST_HOURS of ticks of random
+ *  length with random acceleration, the transforms take
+ *  every ADC value and the formatting a range of values.
+ *  Every difference larger than its bound below is
+ *  printed, and the exit status is 1 if there was one.
+ *********************************************************/
+
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wagon_fixed.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define TEST_HOURS 2
+#define TEST_TICK_MAX_MS 250      // longest tick of the integrator
+#define TEST_LONG_MAX 2147483647LL  // long of the ATmega
+
+// Bounds of the differences with the double formulas
+#define SPEED_BOUND 0.001         // m/s, one unit of the speed
+#define SPEED_REM_BOUND 1e-9      // m/s, with the remainder added
+#define DISTANCE_STEP_BOUND 0.001 // m, per step, one unit
+// m per tick summed over the run, with the remainder: what
+// acc*dt^2/2 loses to the integer divisions, < 0.25 um at 250 ms
+// plus < 1 um
+#define DISTANCE_TICK_BOUND 1.25e-6
+#define PWM_BOUND 1               // steps of the speed led
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static unsigned long failures = 0;
+static unsigned long seed = 1;
+
+/**********************************************************
+ *  Function: test_random
+ *
+ *  Repeatable numbers in 0..n-1.
+ *********************************************************/
+static unsigned long test_random(unsigned long n)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) % n;
+}
+
+/**********************************************************
+ *  Function: test_check
+ *********************************************************/
+static void test_check(int ok, const char *what, double got,
+                       double expected)
+{
+    if (ok)
+        return;
+    failures++;
+    if (failures <= 20)
+        printf("FAIL %s: %.9f, expected %.9f\n", what, got, expected);
+}
+
+/**********************************************************
+ *  Function: test_integrator
+ *
+ *  Speed and distance of fx_speed_step and fx_distance_step
+ *  against the double updates of speed_req and
+ *  actual_distance, fed the same ticks. The double distance
+ *  is run with the fixed speed so each step can be compared
+ *  on its own.
+ *********************************************************/
+static void test_integrator()
+{
+    static const int accs[] = {
+        FX_ACC_DOWN, FX_ACC_UP, FX_ACC_FLAT, FX_ACC, FX_BRAKE,
+        FX_ACC + FX_ACC_DOWN, FX_ACC + FX_ACC_UP, FX_BRAKE + FX_ACC_DOWN,
+        FX_BRAKE + FX_ACC_UP,
+    };
+    long speed = 55500, speed_rem = 0, distance = 0, distance_rem = 0;
+    long step;
+    double speed_d = 55.5, distance_d = 0.0, step_d, dt_s, max_speed = 0.0;
+    double max_distance = 0.0;
+    long long ticks = 0, elapsed = 0, um;
+    unsigned long dt;
+    int acc;
+
+    while (elapsed < TEST_HOURS * 3600000LL) {
+        dt = 1 + test_random(TEST_TICK_MAX_MS);
+        acc = accs[test_random(sizeof(accs) / sizeof(accs[0]))];
+        // keep the wagon in 0-100 m/s, as the controllers do
+        if (speed < 10000 && acc < 0)
+            acc = -acc;
+        if (speed > 100000 && acc > 0)
+            acc = -acc;
+        dt_s = dt / 1000.0;
+
+        speed_d = speed_d + acc / 1000.0 * dt_s;
+        speed = fx_speed_step(speed, acc, dt, &speed_rem);
+        test_check(fabs(speed / 1000.0 - speed_d) < SPEED_BOUND,
+                   "speed", speed / 1000.0, speed_d);
+        test_check(fabs((speed + speed_rem / 1000.0) / 1000.0 - speed_d)
+                   < SPEED_REM_BOUND, "speed with remainder",
+                   (speed + speed_rem / 1000.0) / 1000.0, speed_d);
+        if (fabs(speed / 1000.0 - speed_d) > max_speed)
+            max_speed = fabs(speed / 1000.0 - speed_d);
+
+        // what the ATmega computes in a 32-bit long
+        um = (long long)speed * (long long)dt
+             + (long long)acc * (long long)dt / 2 * (long long)dt / 1000
+             + distance_rem;
+        test_check(um < TEST_LONG_MAX && -um < TEST_LONG_MAX,
+                   "distance step in a long", (double)um, TEST_LONG_MAX);
+
+        step_d = speed / 1000.0 * dt_s + 0.5 * (acc / 1000.0) * dt_s * dt_s;
+        step = fx_distance_step(speed, acc, dt, &distance_rem);
+        test_check(fabs(step / 1000.0 - step_d) < DISTANCE_STEP_BOUND,
+                   "distance step", step / 1000.0, step_d);
+        distance += step;
+        distance_d += step_d;
+        test_check(fabs((distance + distance_rem / 1000.0) / 1000.0
+                        - distance_d) < (ticks + 1) * DISTANCE_TICK_BOUND,
+                   "distance with remainder",
+                   (distance + distance_rem / 1000.0) / 1000.0, distance_d);
+        if (fabs(distance / 1000.0 - distance_d) > max_distance)
+            max_distance = fabs(distance / 1000.0 - distance_d);
+
+        elapsed += dt;
+        ticks++;
+    }
+    printf("integrator: %lld ticks, speed error max %.6f m/s, "
+           "distance error max %.6f m after %.0f km\n", ticks, max_speed,
+           max_distance, distance_d / 1000.0);
+}
+
+/**********************************************************
+ *  Function: test_transforms
+ *
+ *  The range transforms for every ADC value and the speeds
+ *  the led shows.
+ *********************************************************/
+static void test_transforms()
+{
+    int value, lamps_d;
+    long speed;
+    double pwm_d, distance_d;
+
+    for (value = 0; value < 1024; value++) {
+        lamps_d = (value - 54) * (float)100 / 923;
+        test_check(fx_range_lamps(value) == lamps_d, "lamps",
+                   fx_range_lamps(value), lamps_d);
+
+        distance_d = (value - 511) * ((double)80000 / 512) + 10000;
+        test_check(fabs(fx_range_distance(value) / 1000.0 - distance_d) < 1e-9,
+                   "distance", fx_range_distance(value) / 1000.0, distance_d);
+    }
+    for (speed = 40000; speed <= 70000; speed += 7) {
+        pwm_d = (speed / 1000.0 - 40) * (double)255 / 30;
+        test_check(abs(fx_range_speed(speed) - (int)pwm_d) <= PWM_BOUND,
+                   "speed led", fx_range_speed(speed), (int)pwm_d);
+    }
+}
+
+/**********************************************************
+ *  Function: test_format
+ *
+ *  fx_format against printf, except for the "-0" of a
+ *  negative value that rounds to 0, which fx_format does
+ *  not print, and for values half way between two
+ *  outputs, which printf rounds from the binary double.
+ *********************************************************/
+static void test_format()
+{
+    static const int formats[][2] = { {4, 1}, {5, 1}, {4, 0}, {3, 0} };
+    char got[13], expected[32];
+    long value, unit;
+    int i, d;
+
+    for (i = 0; i < 4; i++) {
+        unit = 1000;
+        for (d = 0; d < formats[i][1]; d++)
+            unit /= 10;
+        for (value = -99999; value <= 999999; value += 17) {
+            if (labs(value) % unit == unit / 2 ||
+                (value < 0 && -value < unit / 2))
+                continue;
+            fx_format(got, value, formats[i][0], formats[i][1]);
+            snprintf(expected, sizeof(expected), "%*.*f", formats[i][0],
+                     formats[i][1], value / 1000.0);
+            if (strcmp(got, expected) != 0) {
+                failures++;
+                if (failures <= 20)
+                    printf("FAIL format %ld: \"%s\", expected \"%s\"\n",
+                           value, got, expected);
+            }
+        }
+    }
+}
+
+/**********************************************************
+ *  Function: main
+ *********************************************************/
+int main()
+{
+    test_integrator();
+    test_transforms();
+    test_format();
+    if (failures > 0) {
+        printf("wagon_fixed.h: %lu checks failed\n", failures);
+        return 1;
+    }
+    printf("wagon_fixed.h: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,235 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rm.h"
+#include "trace.h"
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct rm_thread {
+    const struct cyclic_task *task;
+    pthread_t thread;
+    struct periodic loop;
+    struct histo exec;      // run time of the task
+    struct histo response;  // release to task end
+};
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static struct rm_thread threads[RM_MAX_THREADS];
+static int num_threads = 0;
+
+static pthread_mutex_t mode_lock;
+static int current_mode;
+
+// First release and length of the secondary cycles
+static nsec_t rm_epoch;
+static nsec_t rm_frame;
+
+/**********************************************************
+ *  Function: rm_mutex_init
+ *
+ *  Initialises a mutex with priority inheritance, so a
+ *  low priority thread holding it cannot be preempted by
+ *  the medium ones while a high priority thread waits.
+ *********************************************************/
+int rm_mutex_init(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attr;
+    int ret;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    ret = pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return ret;
+}
+
+/**********************************************************
+ *  Function: rm_get_mode
+ *********************************************************/
+int rm_get_mode()
+{
+    int mode;
+    pthread_mutex_lock(&mode_lock);
+    mode = current_mode;
+    pthread_mutex_unlock(&mode_lock);
+    return mode;
+}
+
+/**********************************************************
+ *  Function: rm_change_mode
+ *
+ *  Moves from mode to next unless another task already
+ *  left mode while this one was running.
+ *********************************************************/
+static void rm_change_mode(int mode, int next)
+{
+    pthread_mutex_lock(&mode_lock);
+    if (current_mode == mode)
+        current_mode = next;
+    pthread_mutex_unlock(&mode_lock);
+}
+
+/**********************************************************
+ *  Function: rm_body
+ *
+ *  Runs the task at every release in which the current
+ *  mode is one of its modes.
+ *********************************************************/
+static void *rm_body(void *arg)
+{
+    struct rm_thread *t = arg;
+    int mode, ret;
+    nsec_t begin, end;
+
+    time_sleep_until(t->loop.release);
+    while (1) {
+        mode = rm_get_mode();
+        if (t->task->modes & CYCLIC_MODE(mode)) {
+            trace_context(mode, (t->loop.release - rm_epoch) / rm_frame);
+            begin = time_now();
+            ret = t->task->run();
+            end = time_now();
+            histo_add(&t->exec, end - begin);
+            histo_add(&t->response, end - t->loop.release);
+            if (t->task->flags & CYCLIC_SETS_MODE)
+                rm_change_mode(mode, ret);
+        }
+        periodic_wait(&t->loop);
+    }
+    return NULL;
+}
+
+/**********************************************************
+ *  Function: rm_priority
+ *
+ *  Rank of entry i of table: one priority level below
+ *  every entry that is CYCLIC_CRITICAL when it is not,
+ *  and, among the entries as critical as it, below every
+ *  one with a shorter period, or with the same period
+ *  earlier in the table.
+ *********************************************************/
+static int rm_priority(const struct cyclic_task *table, int n, int caps,
+                       int i, int max)
+{
+    int j, rank = 0;
+    int critical = table[i].flags & CYCLIC_CRITICAL;
+    for (j = 0; j < n; j++) {
+        if ((caps & table[j].caps_required) != table[j].caps_required ||
+            (caps & table[j].caps_excluded))
+            continue;
+        if ((table[j].flags & CYCLIC_CRITICAL) != critical) {
+            if (!critical)
+                rank++;
+            continue;
+        }
+        if (table[j].period < table[i].period ||
+            (table[j].period == table[i].period && j < i))
+            rank++;
+    }
+    return max - 1 - rank;
+}
+
+/**********************************************************
+ *  Function: rm_start
+ *
+ *  Starts one thread per entry of table that runs with the
+ *  bus capabilities caps, on a grid of secondary cycles of
+ *  frame ns starting now in mode. The calling thread drops
+ *  to the lowest priority. Returns -1, after printing why,
+ *  if the threads cannot be created.
+ *********************************************************/
+int rm_start(const struct cyclic_task *table, int n, int caps,
+             nsec_t frame, int mode)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    int i, ret, max;
+    nsec_t start;
+
+#ifdef VIRTUAL_TIME
+    // Every thread would move the clock on its own
+    if (time_is_virtual()) {
+        printf("RM: the threads need real time\n");
+        return -1;
+    }
+#endif
+    if (rm_mutex_init(&mode_lock) != 0) {
+        printf("RM: cannot create the mode mutex\n");
+        return -1;
+    }
+    current_mode = mode;
+
+    max = sched_get_priority_max(SCHED_FIFO);
+    start = time_now() + frame;
+    rm_epoch = start;
+    rm_frame = frame;
+    num_threads = 0;
+    for (i = 0; i < n; i++) {
+        if ((caps & table[i].caps_required) != table[i].caps_required ||
+            (caps & table[i].caps_excluded))
+            continue;
+        if (num_threads == RM_MAX_THREADS) {
+            printf("RM: more than %d tasks\n", RM_MAX_THREADS);
+            return -1;
+        }
+
+        struct rm_thread *t = &threads[num_threads++];
+        memset(t, 0, sizeof(*t));
+        t->task = &table[i];
+        periodic_init(&t->loop, table[i].name, table[i].period * frame,
+                      OVERRUN_SKIP);
+        t->loop.release = start + table[i].phase * frame;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        param.sched_priority = rm_priority(table, n, caps, i, max);
+        pthread_attr_setschedparam(&attr, &param);
+        ret = pthread_create(&t->thread, &attr, rm_body, t);
+        pthread_attr_destroy(&attr);
+        if (ret == EPERM) {
+            // Not allowed to use real-time priorities (host build)
+            printf("RM: no SCHED_FIFO for %s, using the default policy\n",
+                   table[i].name);
+            ret = pthread_create(&t->thread, NULL, rm_body, t);
+        }
+        if (ret != 0) {
+            printf("RM: cannot create the thread of %s (%s)\n",
+                   table[i].name, strerror(ret));
+            return -1;
+        }
+    }
+
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    return 0;
+}
+
+/**********************************************************
+ *  Function: rm_print_stats
+ *
+ *  Run time and response time (from the release) of every
+ *  task. The counters are read while the tasks run, so a
+ *  line may mix two activations.
+ *********************************************************/
+void rm_print_stats()
+{
+    int i;
+
+    histo_print_header("RM tasks");
+    for (i = 0; i < num_threads; i++)
+        histo_print(threads[i].task->name, &threads[i].exec);
+    histo_print_header("response");
+    for (i = 0; i < num_threads; i++)
+        histo_print(threads[i].task->name, &threads[i].response);
+}
@@ -0,0 +1,38 @@
+/**********************************************************
+ *  rm.h
+ *
+ *  Preemptive rate-monotonic executive, the threaded
+ *  alternative to the cyclic executive. Every entry of a
+ *  cyclic task table gets its own SCHED_FIFO thread,
+ *  released every period secondary cycles at its phase.
+ *  CYCLIC_CRITICAL tasks (gas, brake and emergency) rank
+ *  above all others so they preempt the slow polls;
+ *  within each group shorter periods get higher
+ *  priorities and table order breaks the ties. The
+ *  current mode is shared
+ *  under a priority-inheritance mutex. Every activation
+ *  is timed into histograms per task.
+ *********************************************************/
+#ifndef RM_H
+#define RM_H
+
+#include <pthread.h>
+
+#include "cyclic.h"
+#include "timing.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define RM_MAX_THREADS 32
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+int rm_mutex_init(pthread_mutex_t *mutex);
+int rm_start(const struct cyclic_task *table, int n, int caps,
+             nsec_t frame, int mode);
+int rm_get_mode();
+void rm_print_stats();
+
+#endif
@@ -0,0 +1,135 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sensor.h"
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static const char *sensor_names[NUM_SENSORS] = {
+    "speed", "dark", "distance",
+};
+static struct sensor_sample samples[NUM_SENSORS];
+static struct sensor_stats stats[NUM_SENSORS];
+// Held only to copy a sample, never across a refresh
+static pthread_mutex_t sensor_lock;
+
+/**********************************************************
+ *  Function: sensor_init
+ *
+ *  Returns -1 if the mutex could not be created.
+ *********************************************************/
+int sensor_init()
+{
+    pthread_mutexattr_t attr;
+    int ret;
+
+    memset(samples, 0, sizeof(samples));
+    memset(stats, 0, sizeof(stats));
+
+    // Priority inheritance, as the tasks reading the cache run
+    // at every priority
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    ret = pthread_mutex_init(&sensor_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (ret != 0) {
+        printf("Error creating the sensor mutex\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**********************************************************
+ *  Function: sensor_set
+ *
+ *  Stores a value just acquired.
+ *********************************************************/
+void sensor_set(int id, double value)
+{
+    pthread_mutex_lock(&sensor_lock);
+    samples[id].value = value;
+    samples[id].time = time_now();
+    samples[id].seq++;
+    pthread_mutex_unlock(&sensor_lock);
+}
+
+/**********************************************************
+ *  Function: sensor_get
+ *
+ *  Last value of id, however old.
+ *********************************************************/
+struct sensor_sample sensor_get(int id)
+{
+    struct sensor_sample sample;
+
+    pthread_mutex_lock(&sensor_lock);
+    sample = samples[id];
+    pthread_mutex_unlock(&sensor_lock);
+    return sample;
+}
+
+/**********************************************************
+ *  Function: sensor_read
+ *
+ *  Stores in sample the value of id, calling refresh
+ *  first if the cached one was never acquired or is older
+ *  than max_age. refresh reads the sensor from the slave
+ *  and stores it with sensor_set. Returns SENSOR_STALE if
+ *  the value is still too old, with the old one in
+ *  sample, SENSOR_OK otherwise.
+ *********************************************************/
+int sensor_read(int id, nsec_t max_age, int (*refresh)(),
+                struct sensor_sample *sample)
+{
+    int refreshed = 0;
+    nsec_t age;
+
+    *sample = sensor_get(id);
+    age = time_now() - sample->time;
+    if (sample->seq == 0 || age > max_age) {
+        refresh();
+        refreshed = 1;
+        *sample = sensor_get(id);
+        age = time_now() - sample->time;
+    }
+
+    pthread_mutex_lock(&sensor_lock);
+    stats[id].reads++;
+    stats[id].refreshes += refreshed;
+    if (sample->seq == 0 || age > max_age) {
+        stats[id].stale++;
+        pthread_mutex_unlock(&sensor_lock);
+        return SENSOR_STALE;
+    }
+    histo_add(&stats[id].age, age);
+    pthread_mutex_unlock(&sensor_lock);
+    return SENSOR_OK;
+}
+
+/**********************************************************
+ *  Function: sensor_print_stats
+ *
+ *  Reads of each value, the ones that needed a refresh,
+ *  the ones left stale and the age of the values used.
+ *********************************************************/
+void sensor_print_stats()
+{
+    int i;
+    pthread_mutex_lock(&sensor_lock);
+    printf("SENSOR     reads refresh  stale  mean age(us)   max age(us)\n");
+    for (i = 0; i < NUM_SENSORS; i++) {
+        const struct histo *h = &stats[i].age;
+        if (stats[i].reads == 0)
+            continue;
+        printf("%-8s %7lu %7lu %6lu %13lld %13lld\n", sensor_names[i],
+               stats[i].reads, stats[i].refreshes, stats[i].stale,
+               (long long)(histo_mean(h) / 1000),
+               (long long)(h->max / 1000));
+    }
+    pthread_mutex_unlock(&sensor_lock);
+}
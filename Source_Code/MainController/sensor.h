@@ -0,0 +1,58 @@
+/**********************************************************
+ *  sensor.h
+ *
+ *  Shared cache of the sensor values read from the slave.
+ *  Each value keeps the time it was acquired and a
+ *  sequence number that counts its acquisitions, so a
+ *  task can tell how old the value it decides on is.
+ *  sensor_read() takes the oldest age the consumer
+ *  accepts and calls the refresh function it is given
+ *  only when the cached value is older, so a value read
+ *  earlier in the same secondary cycle is not polled again
+ *  and one left from an earlier cycle is not used blindly.
+ *********************************************************/
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include "histo.h"
+#include "timing.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define SENSOR_SPEED    0  // m/s
+#define SENSOR_DARK     1  // 1 below 50% of light, 0 otherwise
+#define SENSOR_DISTANCE 2  // as the DS answer gives it
+#define NUM_SENSORS     3
+
+// Results of sensor_read
+#define SENSOR_OK     0
+#define SENSOR_STALE  1  // older than asked, the refresh failed
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct sensor_sample {
+    double value;
+    nsec_t time;          // of the acquisition
+    unsigned long seq;    // 0 if never acquired
+};
+
+struct sensor_stats {
+    struct histo age;     // of the samples handed to consumers
+    unsigned long reads;
+    unsigned long refreshes;
+    unsigned long stale;
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+int sensor_init();
+void sensor_set(int id, double value);
+struct sensor_sample sensor_get(int id);
+int sensor_read(int id, nsec_t max_age, int (*refresh)(),
+                struct sensor_sample *sample);
+void sensor_print_stats();
+
+#endif
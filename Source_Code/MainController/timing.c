@@ -0,0 +1,166 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "timing.h"
+
+#ifdef VIRTUAL_TIME
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+static int virtual_time = 0;
+static nsec_t virtual_now = 0;
+static nsec_t virtual_limit = 0;
+static void (*virtual_at_limit)() = NULL;
+
+/**********************************************************
+ *  Function: time_use_virtual
+ *
+ *  Switches to virtual time. When a sleep would go past
+ *  limit (if not 0) the clock stops there and at_limit is
+ *  called, which is expected not to return.
+ *********************************************************/
+void time_use_virtual(nsec_t limit, void (*at_limit)())
+{
+    virtual_time = 1;
+    virtual_now = 0;
+    virtual_limit = limit;
+    virtual_at_limit = at_limit;
+}
+
+/**********************************************************
+ *  Function: time_is_virtual
+ *********************************************************/
+int time_is_virtual()
+{
+    return virtual_time;
+}
+#endif
+
+/**********************************************************
+ *  Function: time_now
+ *********************************************************/
+nsec_t time_now()
+{
+    struct timespec ts;
+#ifdef VIRTUAL_TIME
+    if (virtual_time)
+        return virtual_now;
+#endif
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        printf("Error obtaining time\n");
+        return 0;
+    }
+    return (nsec_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/**********************************************************
+ *  Function: time_sleep_until
+ *********************************************************/
+void time_sleep_until(nsec_t t)
+{
+    struct timespec ts;
+#ifdef VIRTUAL_TIME
+    if (virtual_time) {
+        if (virtual_limit && t > virtual_limit) {
+            virtual_now = virtual_limit;
+            virtual_at_limit();
+        }
+        if (t > virtual_now)
+            virtual_now = t;
+        return;
+    }
+#endif
+    ts.tv_sec = (time_t)(t / NS_PER_S);
+    ts.tv_nsec = (long)(t % NS_PER_S);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/**********************************************************
+ *  Function: time_sleep
+ *********************************************************/
+void time_sleep(nsec_t d)
+{
+    if (d > 0)
+        time_sleep_until(time_now() + d);
+}
+
+/**********************************************************
+ *  Function: periodic_init
+ *
+ *  The first release is now.
+ *********************************************************/
+void periodic_init(struct periodic *p, const char *name, nsec_t period,
+                   int policy)
+{
+    memset(p, 0, sizeof(*p));
+    p->name = name;
+    p->period = period;
+    p->policy = policy;
+    p->release = time_now();
+}
+
+/**********************************************************
+ *  Function: periodic_wait
+ *
+ *  Called at the end of a cycle: waits for the next
+ *  release and updates the statistics. Returns the number
+ *  of releases missed by an overrun (0 when on time).
+ *********************************************************/
+int periodic_wait(struct periodic *p)
+{
+    nsec_t now = time_now();
+    nsec_t jitter;
+    int missed = 0;
+
+    p->cycles++;
+    p->release += p->period;
+
+    if (now > p->release) {
+        // The cycle overran its period
+        p->overruns++;
+        missed = (int)((now - p->release) / p->period) + 1;
+        switch (p->policy) {
+            case OVERRUN_SKIP:
+                p->release += (nsec_t)missed * p->period;
+                p->skipped += missed;
+                break;
+            case OVERRUN_CATCHUP:
+                // the release is already due, no sleep
+                return missed;
+            case OVERRUN_DEGRADE:
+                p->release = now;
+                return missed;
+        }
+    }
+
+    time_sleep_until(p->release);
+
+    // Release jitter
+    jitter = time_now() - p->release;
+    p->samples++;
+    if (p->samples == 1 || jitter < p->jitter_min)
+        p->jitter_min = jitter;
+    if (jitter > p->jitter_max)
+        p->jitter_max = jitter;
+    p->jitter_sum += jitter;
+    return missed;
+}
+
+/**********************************************************
+ *  Function: periodic_print
+ *********************************************************/
+void periodic_print(const struct periodic *p)
+{
+    printf("LOOP %s: %lu cycles, %lu overruns, %lu skipped, "
+           "jitter min/mean/max %lld/%lld/%lld us\n",
+           p->name, p->cycles, p->overruns, p->skipped,
+           (long long)(p->jitter_min / 1000),
+           (long long)(p->samples ? p->jitter_sum / (nsec_t)p->samples / 1000 : 0),
+           (long long)(p->jitter_max / 1000));
+}
@@ -0,0 +1,67 @@
+/**********************************************************
+ *  timing.h
+ *
+ *  Monotonic timing core of the controllers. Times are
+ *  int64 nanoseconds of CLOCK_MONOTONIC, so they neither
+ *  overflow on 32-bit targets nor jump with the wall
+ *  clock. Periodic loops sleep to absolute release times
+ *  with clock_nanosleep(TIMER_ABSTIME) and do not drift.
+ *
+ *  Built with VIRTUAL_TIME (host builds), the clock can be
+ *  switched to virtual time: it starts at 0 and only moves
+ *  when the program sleeps, so long single-threaded runs
+ *  against a simulator finish at once.
+ *********************************************************/
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define NS_PER_S  1000000000LL
+#define NS_PER_MS 1000000LL
+
+// What a periodic loop does when a cycle overruns its period
+#define OVERRUN_SKIP    0  // drop the missed releases, keep the phase
+#define OVERRUN_CATCHUP 1  // release at once until back on the grid
+#define OVERRUN_DEGRADE 2  // restart the grid at the overrun
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+typedef int64_t nsec_t;
+
+struct periodic {
+    const char *name;
+    nsec_t period;
+    nsec_t release;       // current release time
+    int policy;
+    // statistics
+    unsigned long cycles;
+    unsigned long overruns;
+    unsigned long skipped;
+    unsigned long samples;
+    nsec_t jitter_min;    // wake-up minus release time
+    nsec_t jitter_max;
+    nsec_t jitter_sum;
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+nsec_t time_now();
+void time_sleep_until(nsec_t t);
+void time_sleep(nsec_t d);
+#ifdef VIRTUAL_TIME
+void time_use_virtual(nsec_t limit, void (*at_limit)());
+int time_is_virtual();
+#endif
+
+void periodic_init(struct periodic *p, const char *name, nsec_t period,
+                   int policy);
+int periodic_wait(struct periodic *p);
+void periodic_print(const struct periodic *p);
+
+#endif
@@ -0,0 +1,299 @@
+/**********************************************************
+ *  INCLUDES
+ *********************************************************/
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bus.h"
+#include "trace.h"
+
+/**********************************************************
+ *  Global Variables
+ *********************************************************/
+// Single producer: trace_add runs with the bus locked. The
+// producer only writes head and the flusher only writes tail.
+static struct trace_record ring[TRACE_SLOTS];
+static unsigned int head = 0;
+static unsigned int tail = 0;
+static uint32_t added = 0;
+static unsigned long dropped = 0;
+
+static int enabled = 0;
+static const char *trace_path = NULL;
+static FILE *trace_file = NULL;
+static sem_t wake;
+// One drain at a time: the flusher or the exit handler
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Context set by the executive, per thread: with RM_THREADS every
+// task thread runs its own exchanges
+static __thread int context_mode = -1;
+static __thread unsigned int context_cycle = 0;
+
+// Console rate limit: lines printed in the current second and
+// records left out by it
+static time_t console_second = 0;
+static int console_lines = 0;
+static unsigned long skipped = 0;
+
+/**********************************************************
+ *  Function: trace_set_file
+ *
+ *  Path of the binary trace; trace_start creates it.
+ *********************************************************/
+void trace_set_file(const char *path)
+{
+    trace_path = path;
+}
+
+/**********************************************************
+ *  Function: trace_context
+ *
+ *  Mode and secondary cycle the next exchanges of the
+ *  calling thread belong to.
+ *********************************************************/
+void trace_context(int mode, unsigned int cycle)
+{
+    context_mode = mode;
+    context_cycle = cycle;
+}
+
+/**********************************************************
+ *  Function: trace_add
+ *
+ *  Records an exchange; called with the bus locked. Never
+ *  waits: with the ring full the record is dropped.
+ *********************************************************/
+void trace_add(int cmd, const char *request, int request_len,
+               const char *answer, int answer_len, nsec_t start,
+               nsec_t latency)
+{
+    struct trace_record *r;
+    unsigned int h;
+
+    if (!enabled)
+        return;
+    added++;
+    h = head;
+    if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= TRACE_SLOTS) {
+        dropped++;
+        return;
+    }
+
+    r = &ring[h % TRACE_SLOTS];
+    memset(r, 0, sizeof(*r));
+    r->start = start;
+    r->latency = (uint32_t)(latency / 1000);
+    r->seq = added;
+    r->cycle = context_cycle;
+    r->mode = (int8_t)context_mode;
+    r->cmd = (uint8_t)cmd;
+    if (request_len > TRACE_REQUEST_LEN)
+        request_len = TRACE_REQUEST_LEN;
+    r->request_len = (uint8_t)request_len;
+    memcpy(r->request, request, request_len);
+    // an empty answer is a slave that did not respond
+    if (answer[0] == '\0')
+        answer_len = 0;
+    if (answer_len > TRACE_ANSWER_LEN)
+        answer_len = TRACE_ANSWER_LEN;
+    r->answer_len = (uint8_t)answer_len;
+    memcpy(r->answer, answer, answer_len);
+
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+    // half full: do not wait for the period of the flusher
+    if (h + 1 - __atomic_load_n(&tail, __ATOMIC_RELAXED) == TRACE_SLOTS / 2)
+        sem_post(&wake);
+}
+
+/**********************************************************
+ *  Function: trace_print
+ *
+ *  One short console line per record: seq, start in s,
+ *  mode/cycle, command, answer ("-" if none) and latency in
+ *  us. At most TRACE_CONSOLE_LINES a second are printed;
+ *  the others are counted in skipped and leave a gap in
+ *  seq.
+ *********************************************************/
+static void trace_print(const struct trace_record *r)
+{
+    struct timespec now;
+    int i, len;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec != console_second) {
+        console_second = now.tv_sec;
+        console_lines = 0;
+    }
+    if (console_lines == TRACE_CONSOLE_LINES) {
+        skipped++;
+        return;
+    }
+    console_lines++;
+
+    printf("TRC %lu %lld.%03lld %d/%u %s ", (unsigned long)r->seq,
+           (long long)(r->start / NS_PER_S),
+           (long long)(r->start % NS_PER_S / NS_PER_MS), r->mode, r->cycle,
+           bus_cmd_name(r->cmd));
+    // the text answers end with a newline
+    len = r->answer_len;
+    if (len > 0 && r->answer[len - 1] == '\n')
+        len--;
+    if (len == 0)
+        printf("-");
+    else if (r->cmd == BUS_REG_READ)
+        for (i = 0; i < len; i++)
+            printf("%02x", (unsigned char)r->answer[i]);
+    else
+        printf("%.*s", len, r->answer);
+    printf(" %lu\n", (unsigned long)r->latency);
+}
+
+/**********************************************************
+ *  Function: trace_drain
+ *
+ *  Writes out the records in the ring; called with
+ *  flush_lock held.
+ *********************************************************/
+static void trace_drain()
+{
+    unsigned int h, t, n, i;
+
+    if (!enabled)
+        return;
+    h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    t = tail;
+    while (t != h) {
+        // up to the end of the ring
+        n = h - t;
+        if (n > TRACE_SLOTS - t % TRACE_SLOTS)
+            n = TRACE_SLOTS - t % TRACE_SLOTS;
+        if (trace_file != NULL)
+            fwrite(&ring[t % TRACE_SLOTS], sizeof(struct trace_record), n,
+                   trace_file);
+        else
+            for (i = 0; i < n; i++)
+                trace_print(&ring[(t + i) % TRACE_SLOTS]);
+        t += n;
+        __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+    }
+    if (trace_file != NULL)
+        fflush(trace_file);
+}
+
+/**********************************************************
+ *  Function: trace_flush
+ *********************************************************/
+void trace_flush()
+{
+    pthread_mutex_lock(&flush_lock);
+    trace_drain();
+    pthread_mutex_unlock(&flush_lock);
+}
+
+/**********************************************************
+ *  Function: trace_flusher
+ *
+ *  Drains the ring every TRACE_FLUSH_MS, or when it is
+ *  half full. It waits on the real clock: in virtual time
+ *  only the controller moves the clock.
+ *********************************************************/
+static void *trace_flusher(void *arg)
+{
+    struct timespec ts;
+
+    while (1) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += TRACE_FLUSH_MS / 1000;
+        ts.tv_nsec += (TRACE_FLUSH_MS % 1000) * NS_PER_MS;
+        if (ts.tv_nsec >= NS_PER_S) {
+            ts.tv_sec++;
+            ts.tv_nsec -= NS_PER_S;
+        }
+        sem_timedwait(&wake, &ts);
+        trace_flush();
+    }
+    return NULL;
+}
+
+/**********************************************************
+ *  Function: trace_at_exit
+ *
+ *  Writes the last records and stops the flusher from
+ *  touching the file, which exit() closes.
+ *********************************************************/
+static void trace_at_exit()
+{
+    pthread_mutex_lock(&flush_lock);
+    trace_drain();
+    enabled = 0;
+    pthread_mutex_unlock(&flush_lock);
+    if (dropped > 0 || skipped > 0)
+        printf("Trace: %lu of %lu records dropped, %lu not printed\n",
+               dropped, (unsigned long)added, skipped);
+}
+
+/**********************************************************
+ *  Function: trace_print_stats
+ *
+ *  Records added so far, dropped with the ring full and
+ *  left out by the console rate limit. Read while the bus
+ *  runs, so the counts may be one exchange apart.
+ *********************************************************/
+void trace_print_stats()
+{
+    if (!enabled)
+        return;
+    printf("TRACE     records  dropped  not printed\n");
+    printf("trace  %10lu %8lu %12lu\n", (unsigned long)added, dropped,
+           skipped);
+}
+
+/**********************************************************
+ *  Function: trace_start
+ *
+ *  Starts recording into the file given to trace_set_file.
+ *  The board, without one, prints the trace on the
+ *  console; the host only
+ *  traces with a file. Returns -1, after printing why, if
+ *  the file, the semaphore or the flusher cannot be
+ *  created.
+ *********************************************************/
+int trace_start()
+{
+    struct trace_header header;
+    pthread_t thread;
+
+#ifndef RASPBERRYPI
+    if (trace_path == NULL)
+        return 0;
+#endif
+    if (trace_path != NULL) {
+        trace_file = fopen(trace_path, "wb");
+        if (trace_file == NULL) {
+            printf("Trace: cannot create %s\n", trace_path);
+            return -1;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(struct trace_record);
+        fwrite(&header, sizeof(header), 1, trace_file);
+    }
+
+    if (sem_init(&wake, 0, 0) != 0) {
+        printf("Trace: cannot create the semaphore\n");
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, trace_flusher, NULL) != 0) {
+        printf("Trace: cannot create the flusher\n");
+        return -1;
+    }
+    atexit(trace_at_exit);
+    enabled = 1;
+    return 0;
+}
@@ -0,0 +1,72 @@
+/**********************************************************
+ *  trace.h
+ *
+ *  Recorder of every bus exchange: the request, the
+ *  answer, when the request was written, how long the
+ *  answer took and the mode and secondary cycle of the
+ *  controller at the time. The bus layer adds the records
+ *  to a fixed ring without locks or waits, and a flusher
+ *  thread drains it into a binary file (host, -T file) or
+ *  prints it on the console (board), one short line per
+ *  record and at most TRACE_CONSOLE_LINES a second. A
+ *  record that finds the ring full, or the console over
+ *  its rate, is counted and leaves a gap in seq; the
+ *  counts are in trace_print_stats() and the exit summary.
+ *
+ *  The file is a struct trace_header followed by struct
+ *  trace_record entries, in the byte order of the host
+ *  that wrote it.
+ *********************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "timing.h"
+
+/**********************************************************
+ *  Constants
+ **********************************************************/
+#define TRACE_SLOTS 4096         // records in the ring, a power of two
+#define TRACE_FLUSH_MS 1000      // longest wait of the flusher
+#define TRACE_CONSOLE_LINES 10   // records printed a second at most
+#define TRACE_MAGIC "BTRC"
+#define TRACE_VERSION 1
+#define TRACE_REQUEST_LEN 8      // MSG_LEN
+#define TRACE_ANSWER_LEN 16      // MSG_LONG_LEN
+
+/**********************************************************
+ *  Types
+ *********************************************************/
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+};
+
+struct trace_record {
+    int64_t start;         // ns, time_now() at the write of the request
+    uint32_t latency;      // us from the write to the answer
+    uint32_t seq;          // records added so far, dropped ones included
+    uint32_t cycle;        // secondary cycle of the controller
+    int8_t mode;           // of the controller, -1 if it has none
+    uint8_t cmd;           // BUS_* command
+    uint8_t request_len;
+    uint8_t answer_len;    // 0 if the slave did not answer
+    char request[TRACE_REQUEST_LEN];
+    char answer[TRACE_ANSWER_LEN];
+};
+
+/**********************************************************
+ *  Functions
+ *********************************************************/
+void trace_set_file(const char *path);
+int trace_start();
+void trace_context(int mode, unsigned int cycle);
+void trace_add(int cmd, const char *request, int request_len,
+               const char *answer, int answer_len, nsec_t start,
+               nsec_t latency);
+void trace_flush();
+void trace_print_stats();
+
+#endif
@@ -6,6 +6,9 @@
 #include <Wire.h>
 #include <time.h>
 #include <float.h>
+#include "wagon_log.h"
+#include "wagon_tick.h"
+#include "wagon_out.h"
 
 // --------------------------------------
 // Global Constants
@@ -25,9 +28,16 @@
 #define BRAKE -0.5
 #define MAX_UNSIGNED_LONG 4294967295
 
+// Log events
+#define EV_SPEED 0  // 0.1 m/s
+#define EV_OVERRUN 1  // cycles that ran late
+
 // --------------------------------------
 // Global Variables
 // --------------------------------------
+const struct log_event log_events[] = {
+  {"SPD", 0}, {"OVERRUN", 0},
+};
 double speed = 55.5;
 bool request_received = false;
 bool answer_requested = false;
@@ -95,7 +105,7 @@ int speed_req()
    double elapsedTime = (double)timeDiff / 1000000;
    totalElapsedTime += elapsedTime;
    speed = speed + (acc+acc_slope) * elapsedTime;
-   Serial.println("SPD: "+String(speed));
+   LOG_D(EV_SPEED, speed*10);
    speed_cmp();
    // while there is enough data for a request
    if ( (request_received) &&
@@ -183,7 +193,7 @@ int acc_req()
    if ( (request_received) &&
         (0 == strcmp("GAS: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_ACC, HIGH);
+      out_pin(LED_ACC, HIGH);
 
       // send the answer for speed request
       sprintf(answer,"GAS:  OK");
@@ -197,7 +207,7 @@ int acc_req()
    else if((request_received) &&
         (0 == strcmp("GAS: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_ACC, LOW);
+      out_pin(LED_ACC, LOW);
       acc = 0;
       // send the answer for speed request
       sprintf(answer,"GAS:  OK");
@@ -220,7 +230,7 @@ int brk_req()
    if ( (request_received) &&
         (0 == strcmp("BRK: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_BRK, HIGH);
+      out_pin(LED_BRK, HIGH);
       acc = BRAKE;
       // send the answer for speed request
       sprintf(answer,"BRK:  OK");
@@ -233,7 +243,7 @@ int brk_req()
    else if((request_received) &&
         (0 == strcmp("BRK: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_BRK, LOW);
+      out_pin(LED_BRK, LOW);
 
       // send the answer for speed request
       sprintf(answer,"BRK:  OK");
@@ -257,7 +267,7 @@ int mix_req()
         (0 == strcmp("MIX: SET",request)) ) {
 
       // Put the Led on. Aqui hay que comprobar el estado del led con la funcion que runea periodicamente
-      digitalWrite(LED_MIX, HIGH);
+      out_pin(LED_MIX, HIGH);
 
       // send the answer for speed request
       sprintf(answer,"MIX:  OK");
@@ -272,7 +282,7 @@ int mix_req()
         (0 == strcmp("MIX: CLR",request)) ) {
 
       // Put the Led off.
-      digitalWrite(LED_MIX, LOW);
+      out_pin(LED_MIX, LOW);
 
       // send the answer for speed request
       sprintf(answer,"MIX:  OK");
@@ -297,11 +307,11 @@ int speed_cmp()
       // Invoke the fucntion TransformRange to convert into the range of [0, 255]
       double brightness = transformRange(speed);
       // Set the Light
-      analogWrite(LED_SPEED, brightness);
+      tick_led(brightness);
    }
    // Set to zero if the speed is not in the range
    else{
-     analogWrite(LED_SPEED, 0);
+     tick_led(0);
    }
 
 }
@@ -349,32 +359,38 @@ void setup()
   pinMode(S3, INPUT);
 
   Serial.begin(9600);
+
+  // Start the minor cycles of the loop
+  tick_begin();
 }
 
+// --------------------------------------
+// Handlers, with their period in minor cycles
+// --------------------------------------
+const struct tick_task tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {acc_req, TICK_CYCLE},
+  {brk_req, TICK_CYCLE},
+  {mix_req, TICK_CYCLE},
+  TICK_END,
+};
+
 // --------------------------------------
 // Function: loop
 // --------------------------------------
 void loop()
 {
-  // Declare the Start Time of the Loop
-  unsigned long start_time = micros();
-  unsigned long end_time = 0;
-  unsigned long lapso = 0;
-  // Infinite Loop
-  while(true){
-
-    speed_req();
-    slope_req();
-    acc_req();
-    brk_req();
-    mix_req();
-
-    // Apply the Sleep Times.
-    end_time = micros();
-    lapso = diffULong(start_time,end_time);
-    start_time = start_time + 200000;
-    lapso = lapso/1000;
-    delay(200 - lapso);
+  // Sample the sensors and apply the commands
+  tick_run(tasks);
 
-  }
+  // Write the outputs that changed
+  out_flush();
+
+  // Print the log in the time left
+  log_flush(log_events);
+
+  // Sleep until the next minor cycle
+  if (tick_wait() > 0)
+    LOG_E(EV_OVERRUN, tick_overruns);
 }
@@ -6,6 +6,10 @@
 #include <Wire.h>
 #include <time.h>
 #include <float.h>
+#include "wagon_log.h"
+#include "wagon_tick.h"
+#include "wagon_out.h"
+#include "wagon_adc.h"
 
 // --------------------------------------
 // Global Constants
@@ -26,9 +30,18 @@
 #define BRAKE -0.5
 #define MAX_UNSIGNED_LONG 4294967295
 
+// Log events
+#define EV_SPEED 0  // 0.1 m/s
+#define EV_LDR 1
+#define EV_LAMPS 2
+#define EV_OVERRUN 3  // cycles that ran late
+
 // --------------------------------------
 // Global Variables
 // --------------------------------------
+const struct log_event log_events[] = {
+  {"SPD", 0}, {"LDR", 0}, {"LAMPS", 0}, {"OVERRUN", 0},
+};
 double speed = 55.5;
 bool request_received = false;
 bool answer_requested = false;
@@ -99,7 +112,7 @@ int speed_req()
    totalElapsedTime += elapsedTime;
 
    speed = speed + (acc+acc_slope) * elapsedTime;
-   Serial.println("SPD: "+String(speed));
+   LOG_D(EV_SPEED, speed*10);
    speed_cmp();
    // while there is enough data for a request
    if ( (request_received) &&
@@ -187,7 +200,7 @@ int acc_req()
    if ( (request_received) &&
         (0 == strcmp("GAS: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_ACC, HIGH);
+      out_pin(LED_ACC, HIGH);
 
       // send the answer for speed request
       sprintf(answer,"GAS:  OK");
@@ -200,7 +213,7 @@ int acc_req()
    else if((request_received) &&
         (0 == strcmp("GAS: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_ACC, LOW);
+      out_pin(LED_ACC, LOW);
       acc = 0;
       // send the answer for speed request
       sprintf(answer,"GAS:  OK");
@@ -223,7 +236,7 @@ int brk_req()
    if ( (request_received) &&
         (0 == strcmp("BRK: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_BRK, HIGH);
+      out_pin(LED_BRK, HIGH);
       acc = BRAKE;
       // send the answer for speed request
       sprintf(answer,"BRK:  OK");
@@ -236,7 +249,7 @@ int brk_req()
    else if((request_received) &&
         (0 == strcmp("BRK: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_BRK, LOW);
+      out_pin(LED_BRK, LOW);
 
       // send the answer for speed request
       sprintf(answer,"BRK:  OK");
@@ -260,7 +273,7 @@ int mix_req()
         (0 == strcmp("MIX: SET",request)) ) {
 
       // Put the Led on. Aqui hay que comprobar el estado del led con la funcion que runea periodicamente
-      digitalWrite(LED_MIX, HIGH);
+      out_pin(LED_MIX, HIGH);
 
       // send the answer for speed request
       sprintf(answer,"MIX:  OK");
@@ -274,7 +287,7 @@ int mix_req()
         (0 == strcmp("MIX: CLR",request)) ) {
 
       // Put the Led off.
-      digitalWrite(LED_MIX, LOW);
+      out_pin(LED_MIX, LOW);
 
       // send the answer for speed request
       sprintf(answer,"MIX:  OK");
@@ -294,11 +307,11 @@ int mix_req()
 int lamps_req()
 {
    // Read the Value of the LDR sensor
-   int ldrStatus = analogRead(ldrPin);
-   Serial.println("StatusLDR:"+String(ldrStatus));
+   int ldrStatus = adc_read(ldrPin);
+   LOG_D(EV_LDR, ldrStatus);
    // Transform the value of ldrStatus into a range between 0 and 99 %
    int lamps = transformRangeLamps(ldrStatus);
-   Serial.println("Lamps:"+String(lamps));
+   LOG_D(EV_LAMPS, lamps);
 
    // while there is enough data for a request
    if ( (request_received) &&
@@ -327,7 +340,7 @@ int lamp_led()
    if ( (request_received) &&
         (0 == strcmp("LAM: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_LAMP, HIGH);
+      out_pin(LED_LAMP, HIGH);
       // send the answer for speed request
       sprintf(answer,"LAM:  OK");
 
@@ -339,7 +352,7 @@ int lamp_led()
    else if((request_received) &&
         (0 == strcmp("LAM: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_LAMP, LOW);
+      out_pin(LED_LAMP, LOW);
 
       // send the answer for  request
       sprintf(answer,"LAM:  OK");
@@ -363,11 +376,11 @@ int speed_cmp()
       // Invoke the fucntion TransformRange to convert into the range of [0, 255]
       double brightness = transformRangeSpeed(speed);
       // Set the Light
-      analogWrite(LED_SPEED, brightness);
+      tick_led(brightness);
    }
    // Set to zero if the speed is not in the range
    else{
-     analogWrite(LED_SPEED, 0);
+     tick_led(0);
    }
 
 }
@@ -425,39 +438,44 @@ void setup()
   // Put the LDR sensor as Input
   pinMode(ldrPin, INPUT);
 
+  // Sample the analog inputs in the background
+  adc_begin();
+
   Serial.begin(9600);
+
+  // Start the minor cycles of the loop
+  tick_begin();
 }
 
+// --------------------------------------
+// Handlers, with their period in minor cycles
+// --------------------------------------
+const struct tick_task tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {acc_req, TICK_CYCLE},
+  {brk_req, TICK_CYCLE},
+  {mix_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {lamp_led, TICK_CYCLE},
+  TICK_END,
+};
+
 // --------------------------------------
 // Function: loop
 // --------------------------------------
 void loop()
 {
-  // Declare the Start Time of the Loop
-  unsigned long start_time = micros();
-  unsigned long end_time = 0;
-  unsigned long lapso = 0;
-  // Infinite Loop
-  while(true){
-
-    speed_req();
-    slope_req();
-    acc_req();
-    brk_req();
-    mix_req();
-    lamps_req();
-    lamp_led();
-
-    // Apply the Sleep Times.
-    end_time = micros();
-    lapso = diffULong(start_time,end_time);
-    start_time = start_time + 200000;
-    lapso = lapso/1000;
-    delay(200 - lapso);
-
-  }
-
+  // Sample the sensors and apply the commands
+  tick_run(tasks);
 
+  // Write the outputs that changed
+  out_flush();
 
+  // Print the log in the time left
+  log_flush(log_events);
 
+  // Sleep until the next minor cycle
+  if (tick_wait() > 0)
+    LOG_E(EV_OVERRUN, tick_overruns);
 }
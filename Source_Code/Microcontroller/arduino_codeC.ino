@@ -6,6 +6,12 @@
 #include <Wire.h>
 #include <time.h>
 #include <float.h>
+#define LOG_LEVEL LOG_INFO
+#include "wagon_log.h"
+#include "wagon_button.h"
+#include "wagon_tick.h"
+#include "wagon_out.h"
+#include "wagon_adc.h"
 
 // --------------------------------------
 // Global Constants
@@ -29,9 +35,22 @@
 #define MAX_UNSIGNED_LONG 4294967295
 
 
+// Log events
+#define EV_RX 0          // request received
+#define EV_TX 1          // answer sent
+#define EV_NO_ANSWER 2   // the master read with nothing to answer
+#define EV_SLOPE 3
+#define EV_DISTANCE 4    // m
+#define EV_LATENCY 5     // us from the press to the mode change
+#define EV_OVERRUN 6     // cycles that ran late
+
 // --------------------------------------
 // Global Variables
 // --------------------------------------
+const struct log_event log_events[] = {
+  {"RX", 1}, {"TX", 1}, {"NO ANSWER", 0}, {"SLOPE", 1}, {"DISTANCE", 0},
+  {"BUTTON LATENCY", 0}, {"OVERRUN", 0},
+};
 const int ldrPin = A0;
 double speed = 55.5;
 bool request_received = false;
@@ -53,23 +72,20 @@ int buttonStateStop = 0;
 int lastButtonStateStop = 0;
 int CURRENT_MODE = 0;
 
-static const struct number {
-    uint8_t d;
-    uint8_t c;
-    uint8_t b;
-    uint8_t a;
-  } numbers[] = {
-    { LOW,  LOW,  LOW,  LOW}, /* 0 */
-    { LOW,  LOW,  LOW, HIGH}, /* 1 */
-    { LOW,  LOW, HIGH,  LOW}, /* 2 */
-    { LOW,  LOW, HIGH, HIGH}, /* 3 */
-    { LOW, HIGH,  LOW,  LOW}, /* 4 */
-    { LOW, HIGH,  LOW, HIGH}, /* 5 */
-    { LOW, HIGH, HIGH,  LOW}, /* 6 */
-    { LOW, HIGH, HIGH, HIGH}, /* 7 */
-    {HIGH,  LOW,  LOW,  LOW}, /* 8 */
-    {HIGH,  LOW,  LOW, HIGH}, /* 9 */
-  };
+// BCD of the digits for P1-P4, bit a first
+static const uint8_t numbers[] = {
+  /* dcba */
+  0b0000, /* 0 */
+  0b0001, /* 1 */
+  0b0010, /* 2 */
+  0b0011, /* 3 */
+  0b0100, /* 4 */
+  0b0101, /* 5 */
+  0b0110, /* 6 */
+  0b0111, /* 7 */
+  0b1000, /* 8 */
+  0b1001, /* 9 */
+};
 
 // --------------------------------------
 // Handler function: receiveEvent
@@ -93,7 +109,7 @@ void receiveEvent(int num)
    if ((num == MESSAGE_SIZE) && (!request_received)) {
       memcpy(request, aux_str, MESSAGE_SIZE+1);
       request_received = true;
-      Serial.println(request);
+      LOG_D(EV_RX, log_text(request));
    }
 }
 
@@ -105,11 +121,11 @@ void requestEvent()
    // if there is an answer send it, else error
    if (answer_requested) {
       Wire.write(answer,MESSAGE_SIZE);
-      Serial.println(answer);
+      LOG_D(EV_TX, log_text(answer));
       memset(answer,'\0', MESSAGE_SIZE+1);
 
    } else {
-      Serial.println("RESPONDED ERROR\n");
+      LOG_E(EV_NO_ANSWER, 0);
       Wire.write("MSG: ERR",MESSAGE_SIZE);
    }
 
@@ -210,7 +226,7 @@ int slope_req()
       memset(request,'\0', MESSAGE_SIZE+1);
       request_received = false;
       answer_requested = true;
-      Serial.println("SLOPE FLAT");
+      LOG_D(EV_SLOPE, log_text("FLAT"));
     }
   }
   return 0;
@@ -225,7 +241,7 @@ int acc_req()
    if ( (request_received) &&
         (0 == strcmp("GAS: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_ACC, HIGH);
+      out_pin(LED_ACC, HIGH);
 
       // send the answer for speed request
       sprintf(answer,"GAS:  OK");
@@ -238,7 +254,7 @@ int acc_req()
    else if((request_received) &&
         (0 == strcmp("GAS: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_ACC, LOW);
+      out_pin(LED_ACC, LOW);
       acc = 0;
       // send the answer for speed request
       sprintf(answer,"GAS:  OK");
@@ -261,7 +277,7 @@ int brk_req()
    if ( (request_received) &&
         (0 == strcmp("BRK: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_BRK, HIGH);
+      out_pin(LED_BRK, HIGH);
       acc = BRAKE;
       // send the answer for speed request
       sprintf(answer,"BRK:  OK");
@@ -274,7 +290,7 @@ int brk_req()
    else if((request_received) &&
         (0 == strcmp("BRK: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_BRK, LOW);
+      out_pin(LED_BRK, LOW);
 
       // send the answer for speed request
       sprintf(answer,"BRK:  OK");
@@ -298,7 +314,7 @@ int mix_req()
         (0 == strcmp("MIX: SET",request)) ) {
 
       // Put the Led on. Aqui hay que comprobar el estado del led con la funcion que runea periodicamente
-      digitalWrite(LED_MIX, HIGH);
+      out_pin(LED_MIX, HIGH);
 
       // send the answer for speed request
       sprintf(answer,"MIX:  OK");
@@ -312,7 +328,7 @@ int mix_req()
         (0 == strcmp("MIX: CLR",request)) ) {
 
       // Put the Led off.
-      digitalWrite(LED_MIX, LOW);
+      out_pin(LED_MIX, LOW);
 
       // send the answer for speed request
       sprintf(answer,"MIX:  OK");
@@ -332,7 +348,7 @@ int mix_req()
 int lamps_req()
 {
    // Read the Value of the LDR sensor
-   int ldrStatus = analogRead(A0);
+   int ldrStatus = adc_read(A0);
    // Transform the value of ldrStatus into a range between 0 and 99 %
    int lamps = transformRangeLamps(ldrStatus);
 
@@ -363,7 +379,7 @@ int lamp_led()
    if ( (request_received) &&
         (0 == strcmp("LAM: SET",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_LAMP, HIGH);
+      out_pin(LED_LAMP, HIGH);
       acc = BRAKE;
       // send the answer for speed request
       sprintf(answer,"LAM:  OK");
@@ -376,7 +392,7 @@ int lamp_led()
    else if((request_received) &&
         (0 == strcmp("LAM: CLR",request)) ) {
       // Put the Led on.
-      digitalWrite(LED_LAMP, LOW);
+      out_pin(LED_LAMP, LOW);
 
       // send the answer for speed request
       sprintf(answer,"LAM:  OK");
@@ -395,7 +411,7 @@ int lamp_led()
 // --------------------------------------
 int distance_req()
 {
-  sensorValue = analogRead(A1);
+  sensorValue = adc_read(A1);
 
   // Transform the Distance between 10000 and 90000
   selected_distance = transformRangeDistance(sensorValue);
@@ -413,11 +429,12 @@ int distance_dsp()
   // convert potentiometer_distance to a 1-9 digit
   int valueToDisplay = dis_value[0] - '0';
 
+  // a blank (under 1000 m) or a sign shows 0
+  if (valueToDisplay < 0 || valueToDisplay > 9)
+    valueToDisplay = 0;
+
   // write on the display the value of the sensor (stored in potentiometer_distance)
-  digitalWrite(P1, numbers[valueToDisplay].a);
-  digitalWrite(P2, numbers[valueToDisplay].b);
-  digitalWrite(P3, numbers[valueToDisplay].c);
-  digitalWrite(P4, numbers[valueToDisplay].d);
+  out_digit(numbers[valueToDisplay]);
 
   return 0;
 }
@@ -428,14 +445,13 @@ int distance_dsp()
 int distance_val()
 {
   // check when the button has been activated (pushed and released)
-  buttonState = digitalRead(6);
+  buttonState = button_read();
 
   //if pushed and released then the potentiometer_distance is selected as the actual distance
   if (buttonState != lastButtonState) {
     CURRENT_MODE = buttonState; // change to approach mode
     act_distance = selected_distance; // Make the selected distance as real distance
-    // delay a little bit to avoid debouncing
-    delay(5); // Wait for 5 millisecond(s)
+    LOG_I(EV_LATENCY, button_latency());
   }
   // save the current state as the last state, for
   // the next time through the loop
@@ -464,10 +480,9 @@ int actual_distance()
     // Change to Selection mode
     CURRENT_MODE = 0;
   }
-  Serial.println("ACT DISTANCE: "+String(act_distance));
+  LOG_D(EV_DISTANCE, act_distance);
   // Store the value of distance
   dtostrf(act_distance,4,0,dis_value);
-  Serial.println("Value DISTANCE: "+String(dis_value));
 
   // Display the current distance
   distance_dsp();
@@ -492,7 +507,7 @@ int actual_distance()
 int stop_end()
 {
   // check when the button has been activated (pushed and released)
-  buttonStateStop = digitalRead(6);
+  buttonStateStop = button_read();
 
   //if pushed and released then the potentiometer_distance is selected as the actual distance
   if (buttonStateStop != lastButtonStateStop) {
@@ -500,8 +515,7 @@ int stop_end()
     timeLast = micros();
     speed = 0.0;
     //act_distance = selected_distance; // Make the selected distance as real distance
-    // delay a little bit to avoid debouncing
-    delay(5); // Wait for 5 millisecond(s)
+    LOG_I(EV_LATENCY, button_latency());
   }
   // save the current state as the last state, for
   // the next time through the loop
@@ -543,11 +557,11 @@ int speed_cmp()
       // Invoke the fucntion TransformRange to convert into the range of [0, 255]
       double brightness = transformRangeSpeed(speed);
       // Set the Light
-      analogWrite(LED_SPEED, brightness);
+      tick_led(brightness);
    }
    // Set to zero if the speed is not in the range
    else{
-     analogWrite(LED_SPEED, 0);
+     tick_led(0);
    }
 
 }
@@ -622,67 +636,76 @@ void setup()
 
   pinMode(A1, INPUT); // Potenciometer
   pinMode(A0, INPUT); // LDR sensor as Input
-  pinMode(6, INPUT); // Button Input
+
+  // Sample the analog inputs in the background
+  adc_begin();
+  button_begin(); // Button Input, debounced by its pin change interrupt
 
   Serial.begin(9600);
+
+  // Start the minor cycles of the loop
+  tick_begin();
 }
 
+// --------------------------------------
+// Handlers of every mode, with their period in minor cycles
+// --------------------------------------
+const struct tick_task selection_tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {acc_req, TICK_CYCLE},
+  {brk_req, TICK_CYCLE},
+  {mix_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {lamp_led, TICK_CYCLE},
+  {distance_req, TICK_CYCLE},
+  {distance_dsp, TICK_CYCLE},
+  {distance_val, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task approach_tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {acc_req, TICK_CYCLE},
+  {brk_req, TICK_CYCLE},
+  {mix_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {lamp_led, TICK_CYCLE},
+  {actual_distance, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task stop_tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {acc_req, TICK_CYCLE},
+  {brk_req, TICK_CYCLE},
+  {mix_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {lamp_led, TICK_CYCLE},
+  {stop_end, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task *const mode_tasks[] = {
+  selection_tasks,  // 0: distance selection
+  approach_tasks,   // 1: approaching
+  stop_tasks,       // 2: stop
+};
+
 // --------------------------------------
 // Function: loop
 // --------------------------------------
 void loop()
 {
-  // Declare the Start Time of the Loop
-  unsigned long start_time = micros();
-  unsigned long end_time = 0;
-  unsigned long lapso = 0;
-  while(true){
-
-    switch(CURRENT_MODE){
-      case 0: // Distance selection mode
-        speed_req();
-        slope_req();
-        acc_req();
-        brk_req();
-        mix_req();
-        lamps_req();
-        lamp_led();
-        distance_req();
-        distance_dsp();
-        distance_val();
-        break;
-
-      case 1: // Approaching mode
-        speed_req();
-        slope_req();
-        acc_req();
-        brk_req();
-        mix_req();
-        lamps_req();
-        lamp_led();
-        actual_distance();
-        break;
-
-      case 2: // Stop mode
-        speed_req();
-        slope_req();
-        acc_req();
-        brk_req();
-        mix_req();
-        lamps_req();
-        lamp_led();
-        stop_end();
-        break;
-
-    }
+  // Sample the sensors and apply the commands of the mode
+  tick_run(mode_tasks[CURRENT_MODE]);
 
-    // Apply the Sleep Times
-    end_time = micros();
-    lapso = diffULong(start_time,end_time);
-    start_time = start_time + 200000;
-    lapso = lapso/1000;
-    delay(200 - lapso);
+  // Write the outputs that changed
+  out_flush();
 
-  }
+  // Print the log in the time left
+  log_flush(log_events);
 
+  // Sleep until the next minor cycle
+  if (tick_wait() > 0)
+    LOG_E(EV_OVERRUN, tick_overruns);
 }
@@ -6,12 +6,21 @@
 #include <Wire.h>
 #include <time.h>
 #include <float.h>
+#include "wagon_fixed.h"
+// LOG_DEBUG traces every frame and distance update
+#define LOG_LEVEL LOG_INFO
+#include "wagon_log.h"
+#include "wagon_button.h"
+#include "wagon_tick.h"
+#include "wagon_out.h"
+#include "wagon_adc.h"
 
 // --------------------------------------
 // Global Constants
 // --------------------------------------
 #define SLAVE_ADDR 0x8
 #define MESSAGE_SIZE 8
+#define LONG_MESSAGE_SIZE 16
 #define LED_ACC 13
 #define LED_BRK 12
 #define LED_MIX 11
@@ -21,55 +30,139 @@
 #define P2 3
 #define P3 4
 #define P4 5
-#define ACC_DOWN 0.25
-#define ACC_UP -0.25
-#define ACC_FLAT 0
-#define ACC 0.5
-#define BRAKE -0.5
 #define MAX_UNSIGNED_LONG 4294967295
+// Capabilities advertised in the CAP answer
+#define CAP_COMPOUND 0x0001
+#define CAP_READY_POLL 0x0002
+#define CAP_REGISTERS 0x0004
+#define CAP_PIPELINE 0x0008
+// Binary register map, little-endian fixed point (see bus.h)
+#define REG_SPEED 0      // int16, 0.01 m/s
+#define REG_ACCEL 2      // int16, 0.001 m/s2
+#define REG_SLOPE 4      // uint8, 0 flat, 1 up, 2 down, 3 both
+#define REG_LIGHT 5      // uint8, %
+#define REG_DISTANCE 6   // int32, mm to the stop
+#define REG_MODE 10      // uint8, CURRENT_MODE
+#define REG_FLAGS 11     // uint8, gas 1, brake 2, mixer 4, lamps 8
+#define REG_SIZE 12
+#define REG_SELECT 0x80
+#define FIFO_SLOTS 4     // requests queued, a power of two
+// Requests, decoded once by receiveEvent
+#define CMD_UNKNOWN 0
+#define CMD_SPD_REQ 1
+#define CMD_SLP_REQ 2
+#define CMD_LIT_REQ 3
+#define CMD_DS_REQ 4
+#define CMD_STP_REQ 5
+#define CMD_SNS_REQ 6
+#define CMD_CAP_REQ 7
+#define CMD_GAS_SET 8
+#define CMD_GAS_CLR 9
+#define CMD_BRK_SET 10
+#define CMD_BRK_CLR 11
+#define CMD_MIX_SET 12
+#define CMD_MIX_CLR 13
+#define CMD_LAM_SET 14
+#define CMD_LAM_CLR 15
+#define CMD_ERR_SET 16
+#define CMD_ACT 17
+#define CMD_COUNT 18
+// Log events
+#define EV_RX 0          // request received
+#define EV_TX 1          // answer sent
+#define EV_NO_ANSWER 2   // the master read with nothing to answer
+#define EV_MODE 3        // new CURRENT_MODE
+#define EV_LDR 4
+#define EV_LAMPS 5
+#define EV_BUTTON 6
+#define EV_DISTANCE 7    // mm
+#define EV_LATENCY 8     // us from the press to the mode change
+#define EV_OVERRUN 9     // cycles that ran late
+#define EV_FIFO_FULL 10  // request dropped
+// Four chars packed in a 32-bit key, first char in the low byte
+#define KEY(a,b,c,d) ((uint32_t)(uint8_t)(a) | (uint32_t)(uint8_t)(b) << 8 | \
+                      (uint32_t)(uint8_t)(c) << 16 | (uint32_t)(uint8_t)(d) << 24)
 
 
 // --------------------------------------
 // Global Variables
 // --------------------------------------
 const int ldrPin = A0;
-double speed = 55.5;
-bool request_received = false;
-bool answer_requested = false;
-char request[MESSAGE_SIZE+1];
-char answer[MESSAGE_SIZE+1];
-double elapsedTime = 0.0;
-double acc_slope = 0.0;
-double acc = 0.0;
+long speed = 55500;          // mm/s
+long speed_rem = 0;
+unsigned long elapsedTime = 0;  // ms
+int acc_slope = 0;           // mm/s2
+int acc = 0;                 // mm/s2
 unsigned long timeLast = micros();
 int lamps = 0;
-char dis_value[5];
-double selected_distance = 0.0;
-double act_distance = 0.0;
+char dis_value[7];
+long selected_distance = 0;  // mm
+long act_distance = 0;       // mm
+long distance_rem = 0;
 int sensorValue = 0;
 int buttonState = 0;
 int lastButtonState = 0;
 int buttonStateStop = 0;
 int lastButtonStateStop = 0;
 int CURRENT_MODE = 0;
-
-static const struct number {
-    uint8_t d;
-    uint8_t c;
-    uint8_t b;
-    uint8_t a;
-  } numbers[] = {
-    { LOW,  LOW,  LOW,  LOW}, /* 0 */
-    { LOW,  LOW,  LOW, HIGH}, /* 1 */
-    { LOW,  LOW, HIGH,  LOW}, /* 2 */
-    { LOW,  LOW, HIGH, HIGH}, /* 3 */
-    { LOW, HIGH,  LOW,  LOW}, /* 4 */
-    { LOW, HIGH,  LOW, HIGH}, /* 5 */
-    { LOW, HIGH, HIGH,  LOW}, /* 6 */
-    { LOW, HIGH, HIGH, HIGH}, /* 7 */
-    {HIGH,  LOW,  LOW,  LOW}, /* 8 */
-    {HIGH,  LOW,  LOW, HIGH}, /* 9 */
-  };
+const struct log_event log_events[] = {
+  {"RX", 1}, {"TX", 1}, {"NO ANSWER", 0}, {"MODE", 0},
+  {"LDR", 0}, {"LAMPS", 0}, {"BUTTON", 0}, {"DISTANCE", 0},
+  {"BUTTON LATENCY", 0}, {"OVERRUN", 0}, {"FIFO FULL", 1},
+};
+int slope_up = 0;
+int slope_down = 0;
+
+// Answers of the read requests, refreshed by the loop every tick.
+// An empty answer means the request is not served in that mode.
+struct snapshot {
+  char spd[MESSAGE_SIZE+2];
+  char slp[MESSAGE_SIZE+2];
+  char lit[MESSAGE_SIZE+2];
+  char ds[MESSAGE_SIZE+2];
+  char stp[MESSAGE_SIZE+2];
+  char sns[LONG_MESSAGE_SIZE+1];
+  uint8_t regs[REG_SIZE];
+};
+// The loop writes one copy while receiveEvent reads the other
+struct snapshot snapshots[2];
+volatile uint8_t snapshot_idx = 0;
+// Requests in arrival order with their answers. receiveEvent
+// fills the slot at fifo_head, the loop runs the commands from
+// fifo_run on and requestEvent sends the answers from fifo_tail
+// on. A slot is reused once both have passed it.
+struct slot {
+  char request[MESSAGE_SIZE+1];
+  char answer[LONG_MESSAGE_SIZE+1];
+  uint8_t answer_size;
+  uint8_t cmd;
+  volatile bool ready;  // answer complete
+};
+struct slot fifo[FIFO_SLOTS];
+volatile uint8_t fifo_head = 0;
+volatile uint8_t fifo_run = 0;
+volatile uint8_t fifo_tail = 0;
+// Slot of the command the loop is running
+struct slot *current = NULL;
+// CAP answer, built once by setup
+char cap_answer[MESSAGE_SIZE+1];
+// Register selected by the last select byte, -1 if none
+volatile int reg_selected = -1;
+
+// BCD of the digits for P1-P4, bit a first
+static const uint8_t numbers[] = {
+  /* dcba */
+  0b0000, /* 0 */
+  0b0001, /* 1 */
+  0b0010, /* 2 */
+  0b0011, /* 3 */
+  0b0100, /* 4 */
+  0b0101, /* 5 */
+  0b0110, /* 6 */
+  0b0111, /* 7 */
+  0b1000, /* 8 */
+  0b1001, /* 9 */
+};
 
 // --------------------------------------
 // Handler function: receiveEvent
@@ -89,12 +182,183 @@ void receiveEvent(int num)
    }
    aux_str[i]='\0';
 
-   // if message is correct, load it
-   if ((num == MESSAGE_SIZE) && (!request_received)) {
-      memcpy(request, aux_str, MESSAGE_SIZE+1);
-      request_received = true;
-      Serial.println(request);
+   // a select byte starts a burst read of the registers,
+   // answered at once without disturbing the text requests
+   if ((num == 1) && ((uint8_t)aux_str[0] & REG_SELECT)) {
+      reg_selected = (uint8_t)aux_str[0] & ~REG_SELECT;
+      return;
+   }
+
+   if (num != MESSAGE_SIZE)
+      return;
+   // the master keeps at most FIFO_SLOTS requests unanswered
+   if ((uint8_t)(fifo_head - fifo_tail) >= FIFO_SLOTS ||
+       (uint8_t)(fifo_head - fifo_run) >= FIFO_SLOTS) {
+      LOG_E(EV_FIFO_FULL, log_text(aux_str));
+      return;
+   }
+
+   // if message is correct, queue it
+   struct slot *slot = &fifo[fifo_head % FIFO_SLOTS];
+   memcpy(slot->request, aux_str, MESSAGE_SIZE+1);
+   LOG_D(EV_RX, log_text(slot->request));
+   slot->cmd = command_decode(slot->request);
+   // read requests are answered at once from the snapshot,
+   // the rest is left to the loop
+   slot->ready = snapshot_answer(slot);
+   fifo_head++;
+}
+
+// --------------------------------------
+// Function: command_decode
+// --------------------------------------
+uint8_t command_decode(const char *msg)
+{
+   // the first four chars tell the command, the last four
+   // its argument
+   uint32_t head = KEY(msg[0], msg[1], msg[2], msg[3]);
+   uint32_t tail = KEY(msg[4], msg[5], msg[6], msg[7]);
+   const uint32_t req = KEY(' ','R','E','Q');
+   const uint32_t set = KEY(' ','S','E','T');
+   const uint32_t clr = KEY(' ','C','L','R');
+
+   switch (head) {
+      case KEY('S','P','D',':'): return tail == req ? CMD_SPD_REQ : CMD_UNKNOWN;
+      case KEY('S','L','P',':'): return tail == req ? CMD_SLP_REQ : CMD_UNKNOWN;
+      case KEY('L','I','T',':'): return tail == req ? CMD_LIT_REQ : CMD_UNKNOWN;
+      case KEY('D','S',':',' '): return tail == req ? CMD_DS_REQ : CMD_UNKNOWN;
+      case KEY('S','T','P',':'): return tail == req ? CMD_STP_REQ : CMD_UNKNOWN;
+      case KEY('S','N','S',':'): return tail == req ? CMD_SNS_REQ : CMD_UNKNOWN;
+      case KEY('C','A','P',':'): return tail == req ? CMD_CAP_REQ : CMD_UNKNOWN;
+      case KEY('G','A','S',':'):
+         return tail == set ? CMD_GAS_SET : (tail == clr ? CMD_GAS_CLR : CMD_UNKNOWN);
+      case KEY('B','R','K',':'):
+         return tail == set ? CMD_BRK_SET : (tail == clr ? CMD_BRK_CLR : CMD_UNKNOWN);
+      case KEY('M','I','X',':'):
+         return tail == set ? CMD_MIX_SET : (tail == clr ? CMD_MIX_CLR : CMD_UNKNOWN);
+      case KEY('L','A','M',':'):
+         return tail == set ? CMD_LAM_SET : (tail == clr ? CMD_LAM_CLR : CMD_UNKNOWN);
+      case KEY('E','R','R',':'): return tail == set ? CMD_ERR_SET : CMD_UNKNOWN;
+      case KEY('A','C','T',':'): return msg[4] == ' ' ? CMD_ACT : CMD_UNKNOWN;
+   }
+   return CMD_UNKNOWN;
+}
+
+// --------------------------------------
+// Function: snapshot_answer
+// --------------------------------------
+bool snapshot_answer(struct slot *slot)
+{
+   const struct snapshot *snap = &snapshots[snapshot_idx];
+   const char *value;
+   uint8_t cmd = slot->cmd;
+
+   switch (cmd) {
+      case CMD_SPD_REQ: value = snap->spd; break;
+      case CMD_SLP_REQ: value = snap->slp; break;
+      case CMD_LIT_REQ: value = snap->lit; break;
+      case CMD_DS_REQ: value = snap->ds; break;
+      case CMD_STP_REQ: value = snap->stp; break;
+      case CMD_SNS_REQ: value = snap->sns; break;
+      case CMD_CAP_REQ: value = cap_answer; break;
+      case CMD_UNKNOWN: value = ""; break;  // refused at once
+      default: return false;
+   }
+
+   slot->answer_size = (cmd == CMD_SNS_REQ) ? LONG_MESSAGE_SIZE : MESSAGE_SIZE;
+   // not served in this mode
+   if (value[0] == '\0') {
+      value = "MSG: ERR";
+      slot->answer_size = MESSAGE_SIZE;
    }
+   memcpy(slot->answer, value, slot->answer_size+1);
+   return true;
+}
+
+// --------------------------------------
+// Function: reg_put
+// --------------------------------------
+void reg_put(uint8_t *reg, long value, int size)
+{
+   for (int i = 0; i < size; i++) {
+      reg[i] = value & 0xFF;
+      value >>= 8;
+   }
+}
+
+// --------------------------------------
+// Function: snap_put
+// --------------------------------------
+void snap_put(char *dst, const char *prefix, const char *text, int size)
+{
+   // prefix and text, cut to the size of dst
+   strcpy(dst,prefix);
+   strncat(dst,text,size-1-strlen(prefix));
+}
+
+// --------------------------------------
+// Function: snapshot_update
+// --------------------------------------
+void snapshot_update(int mode)
+{
+   struct snapshot *snap = &snapshots[1 - snapshot_idx];
+   char num_str[13];
+
+   // Speed, served in every mode
+   snap_put(snap->spd,"SPD:",fx_format(num_str,speed,4,1),sizeof(snap->spd));
+
+   // Slope, unless both switches are on
+   if (slope_up && !slope_down) strcpy(snap->slp,"SLP:  UP");
+   else if (!slope_up && slope_down) strcpy(snap->slp,"SLP:DOWN");
+   else if (!slope_up && !slope_down) strcpy(snap->slp,"SLP:FLAT");
+   else snap->slp[0] = '\0';
+
+   // Light, out of emergency mode
+   if (mode != 3) {
+      fx_format(num_str,(long)lamps*1000,3,0);
+      snap_put(snap->lit,"LIT: ",num_str,sizeof(snap->lit));
+   } else {
+      snap->lit[0] = '\0';
+   }
+
+   // Distance, while approaching
+   if (mode == 1) snap_put(snap->ds,"DS:",dis_value,sizeof(snap->ds));
+   else snap->ds[0] = '\0';
+
+   // Movement, in stop mode
+   if (mode == 2) strcpy(snap->stp, CURRENT_MODE != 2 ? "STP:  GO" : "STP:STOP");
+   else snap->stp[0] = '\0';
+
+   // Compound SNS<speed:5><slope:1><light:2><distance:5>
+   char *p = snap->sns;
+   memcpy(p,"SNS",3);
+   fx_format(num_str,speed,5,1);
+   memcpy(p+3,num_str,5);
+   p += 8;
+   if (acc_slope == FX_ACC_UP) *p++ = 'U';
+   else if (acc_slope == FX_ACC_DOWN) *p++ = 'D';
+   else *p++ = 'F';
+   p = fx_digits(p, constrain(lamps, 0, 99), 2);
+   long distance = 0;
+   if (CURRENT_MODE == 1) distance = constrain(act_distance/1000, 0L, 99999L);
+   p = fx_digits(p, distance, 5);
+   *p = '\0';
+
+   // Register map
+   reg_put(snap->regs + REG_SPEED, constrain(speed/10, -32768L, 32767L), 2);
+   reg_put(snap->regs + REG_ACCEL, (long)(acc+acc_slope), 2);
+   snap->regs[REG_SLOPE] = slope_up ? (slope_down ? 3 : 1) : (slope_down ? 2 : 0);
+   snap->regs[REG_LIGHT] = constrain(lamps, 0, 100);
+   reg_put(snap->regs + REG_DISTANCE,
+           CURRENT_MODE == 1 ? act_distance : 0L, 4);
+   snap->regs[REG_MODE] = CURRENT_MODE;
+   snap->regs[REG_FLAGS] = (out_level(LED_ACC) ? 0x01 : 0) |
+                           (out_level(LED_BRK) ? 0x02 : 0) |
+                           (out_level(LED_MIX) ? 0x04 : 0) |
+                           (out_level(LED_LAMP) ? 0x08 : 0);
+
+   // publish the new copy
+   snapshot_idx = 1 - snapshot_idx;
 }
 
 // --------------------------------------
@@ -102,22 +366,38 @@ void receiveEvent(int num)
 // --------------------------------------
 void requestEvent()
 {
-   // if there is an answer send it, else error
-   if (answer_requested) {
-      Wire.write(answer,MESSAGE_SIZE);
-      Serial.println(answer);
-      memset(answer,'\0', MESSAGE_SIZE+1);
+   // registers from the selected one to the end of the map,
+   // the master reads as many as it needs
+   if (reg_selected >= 0) {
+      const struct snapshot *snap = &snapshots[snapshot_idx];
+      uint8_t burst[REG_SIZE+1];
+      int first = reg_selected;
+      reg_selected = -1;
+      if (first >= REG_SIZE) {
+         Wire.write("MSG: ERR",MESSAGE_SIZE);
+         return;
+      }
+      burst[0] = REG_SELECT | first;
+      memcpy(burst + 1, snap->regs + first, REG_SIZE - first);
+      Wire.write(burst, REG_SIZE - first + 1);
+      return;
+   }
 
-   } else {
-      Serial.println("RESPONDED ERROR\n");
+   // the answer of the oldest request if it is ready, a poll
+   // again if the loop has not run it yet, else error
+   if (fifo_tail == fifo_head) {
+      LOG_E(EV_NO_ANSWER, 0);
       Wire.write("MSG: ERR",MESSAGE_SIZE);
+      return;
    }
-
-   // set answer empty
-   request_received = false;
-   answer_requested = false;
-   memset(request,'\0', MESSAGE_SIZE+1);
-   memset(answer,'0', MESSAGE_SIZE);
+   struct slot *slot = &fifo[fifo_tail % FIFO_SLOTS];
+   if (!slot->ready) {
+      Wire.write("MSG:BUSY",MESSAGE_SIZE);
+      return;
+   }
+   Wire.write(slot->answer,slot->answer_size);
+   LOG_D(EV_TX, log_text(slot->answer));
+   fifo_tail++;
 }
 
 // --------------------------------------
@@ -126,38 +406,24 @@ void requestEvent()
 int speed_req()
 {
    // if its in Emergency mode, when the speed is null, we brake the entire system
-   if(CURRENT_MODE == 3 && speed <=0.0){
-    speed = 0.0;
+   if(CURRENT_MODE == 3 && speed <= 0){
+    speed = 0;
+    speed_rem = 0;
    }
    else if(CURRENT_MODE != 2){
      unsigned long newtime = micros();
      unsigned long timeDiff = diffULong(timeLast, newtime);
-     timeLast = newtime;
-     elapsedTime = (double)timeDiff / 1000000;
-     speed = speed + (acc+acc_slope) * elapsedTime;
+     // whole ms, the rest counts in the next tick
+     elapsedTime = timeDiff / 1000;
+     timeLast += elapsedTime * 1000;
+     speed = fx_speed_step(speed, acc+acc_slope, elapsedTime, &speed_rem);
    }
     else {
-    speed = 0.0;
+    speed = 0;
+    speed_rem = 0;
    }
 
    speed_cmp();
-   // while there is enough data for a request
-   if ( (request_received) &&
-        (0 == strcmp("SPD: REQ",request)) ) {
-
-      Serial.println("ACC."+String(acc)+" SLP."+String(acc_slope));
-      // send the answer for speed request
-      char num_str[5];
-      dtostrf(speed,4,1,num_str);
-      sprintf(answer,"SPD:%s",num_str);
-
-
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
    return 0;
 }
 
@@ -173,88 +439,37 @@ int slope_req()
   // UP is triggered
   if(up && !down){
       // Change the Acceleration
-      acc_slope = ACC_UP;
+      acc_slope = FX_ACC_UP;
   }
   else if(!up && down){
       // Change the Acceleration
-      acc_slope = ACC_DOWN;
+      acc_slope = FX_ACC_DOWN;
   }
   else if(!down && !up){
       // Change the Acceleration
-      acc_slope = ACC_FLAT;
+      acc_slope = FX_ACC_FLAT;
   }
 
-  // while there is enough data for a request
-  if ( (request_received) &&
-      (0 == strcmp("SLP: REQ",request)) ) {
-    // Check the state
-
-    // UP is triggered
-  if(up && !down){
-      // Set the response MSG
-      sprintf(answer,"SLP:  UP");
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-    }
-    // DOWN is triggered
-  else if(!up && down){
-      // Set the response MSG
-      sprintf(answer,"SLP:DOWN");
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-    }
-    // Is in Flat
-  else if(!down && !up){
-      // Set the response MSG
-      sprintf(answer,"SLP:FLAT");
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-      Serial.println("SLOPE FLAT");
-    }
-  }
+  // Keep the switches for the snapshot
+  slope_up = up;
+  slope_down = down;
   return 0;
 }
 
 // --------------------------------------
-// Function: Activate / Deactivate Accelerator
+// Function: acc_set
 // --------------------------------------
-int acc_req()
+void acc_set(int on)
 {
-   // while there is enough data for a request
-   if ( (request_received) &&
-        (0 == strcmp("GAS: SET",request)) ) {
-      // Put the Led on.
-      digitalWrite(LED_ACC, HIGH);
-
-      // send the answer for speed request
-      sprintf(answer,"GAS:  OK");
-      acc = ACC;
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
-   else if((request_received) &&
-        (0 == strcmp("GAS: CLR",request)) ) {
+   if (on) {
       // Put the Led on.
-      digitalWrite(LED_ACC, LOW);
+      out_pin(LED_ACC, HIGH);
+      acc = FX_ACC;
+   } else {
+      // Put the Led off.
+      out_pin(LED_ACC, LOW);
       acc = 0;
-      // send the answer for speed request
-      sprintf(answer,"GAS:  OK");
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
    }
-
-   return 0;
 }
 
 // --------------------------------------
@@ -262,46 +477,26 @@ int acc_req()
 // --------------------------------------
 int acc_emg_req(){
   // Turn off the Gas Light
-  digitalWrite(LED_ACC, LOW);
+  out_pin(LED_ACC, LOW);
   acc = 0;
   return 0;
 }
 
 
 // --------------------------------------
-// Function: Activate / Deactivate Brake
+// Function: brk_set
 // --------------------------------------
-int brk_req()
+void brk_set(int on)
 {
-   // while there is enough data for a request
-   if ( (request_received) &&
-        (0 == strcmp("BRK: SET",request)) ) {
+   if (on) {
       // Put the Led on.
-      digitalWrite(LED_BRK, HIGH);
-      acc = BRAKE;
-      // send the answer for speed request
-      sprintf(answer,"BRK:  OK");
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
-   else if((request_received) &&
-        (0 == strcmp("BRK: CLR",request)) ) {
-      // Put the Led on.
-      digitalWrite(LED_BRK, LOW);
-
-      // send the answer for speed request
-      sprintf(answer,"BRK:  OK");
-      acc=0.0;
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
+      out_pin(LED_BRK, HIGH);
+      acc = FX_BRAKE;
+   } else {
+      // Put the Led off.
+      out_pin(LED_BRK, LOW);
+      acc = 0;
    }
-
-   return 0;
 }
 
 // --------------------------------------
@@ -309,114 +504,41 @@ int brk_req()
 // --------------------------------------
 int brk_emg_req(){
   // Turn off the Gas Light
-  digitalWrite(LED_BRK, HIGH);
-  acc = BRAKE;
+  out_pin(LED_BRK, HIGH);
+  acc = FX_BRAKE;
   return 0;
 }
 
 
-// --------------------------------------
-// Function: Activate / Deactivate Brake
-// --------------------------------------
-int mix_req()
-{
-   // while there is enough data for a request
-   if ( (request_received) &&
-        (0 == strcmp("MIX: SET",request)) ) {
-
-      // Put the Led on. Aqui hay que comprobar el estado del led con la funcion que runea periodicamente
-      digitalWrite(LED_MIX, HIGH);
-
-      // send the answer for speed request
-      sprintf(answer,"MIX:  OK");
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
-   else if((request_received) &&
-        (0 == strcmp("MIX: CLR",request)) ) {
-
-      // Put the Led off.
-      digitalWrite(LED_MIX, LOW);
-
-      // send the answer for speed request
-      sprintf(answer,"MIX:  OK");
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
-
-   return 0;
-}
-
 // --------------------------------------
 // Function: lamps_req
 // --------------------------------------
 int lamps_req()
 {
    // Read the Value of the LDR sensor
-   int ldrStatus = analogRead(A0);
-   //Serial.println("StatusLDR:"+String(ldrStatus));
+   int ldrStatus = adc_read(A0);
+   LOG_D(EV_LDR, ldrStatus);
    // Transform the value of ldrStatus into a range between 0 and 99 %
-   int lamps = transformRangeLamps(ldrStatus);
-   //Serial.println("Lamps:"+String(lamps));
-
-   // while there is enough data for a request
-   if ( (request_received) &&
-        (0 == strcmp("LIT: REQ",request)) ) {
-
-      // send the answer for speed request
-      char num_str[5];
-      dtostrf(lamps,3,0,num_str);
+   lamps = fx_range_lamps(ldrStatus);
+   LOG_D(EV_LAMPS, lamps);
 
-      sprintf(answer,"LIT: %s%",num_str);
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
    return 0;
 }
 
 // --------------------------------------
-// Function: Activate / Deactivate Brake
+// Function: lamp_set
 // --------------------------------------
-int lamp_led()
+void lamp_set(int on)
 {
-   // while there is enough data for a request
-   if ( (request_received) &&
-        (0 == strcmp("LAM: SET",request)) ) {
-      // Put the Led on.
-      digitalWrite(LED_LAMP, HIGH);
-      acc = BRAKE;
-      // send the answer for speed request
-      sprintf(answer,"LAM:  OK");
-
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
-   }
-   else if((request_received) &&
-        (0 == strcmp("LAM: CLR",request)) ) {
+   if (on) {
       // Put the Led on.
-      digitalWrite(LED_LAMP, LOW);
-
-      // send the answer for speed request
-      sprintf(answer,"LAM:  OK");
-      acc=0.0;
-      // set buffers and flags
-      memset(request,'\0', MESSAGE_SIZE+1);
-      request_received = false;
-      answer_requested = true;
+      out_pin(LED_LAMP, HIGH);
+      acc = FX_BRAKE;
+   } else {
+      // Put the Led off.
+      out_pin(LED_LAMP, LOW);
+      acc = 0;
    }
-
-   return 0;
 }
 
 // --------------------------------------
@@ -424,7 +546,7 @@ int lamp_led()
 // --------------------------------------
 int lamp_emg_led(){
   // Put the Led on.
-  digitalWrite(LED_LAMP, HIGH);
+  out_pin(LED_LAMP, HIGH);
   return 0;
 }
 
@@ -433,12 +555,12 @@ int lamp_emg_led(){
 // --------------------------------------
 int distance_req()
 {
-  sensorValue = analogRead(A1);
+  sensorValue = adc_read(A1);
 
   // Transform the Distance between 10000 and 90000
-  selected_distance = transformRangeDistance(sensorValue);
-  // Store the value of distance
-  dtostrf(selected_distance,4,0,dis_value);
+  selected_distance = fx_range_distance(sensorValue);
+  // Store the value of distance, in m
+  fx_format(dis_value,selected_distance,4,0);
 
   return 0;
 }
@@ -451,11 +573,12 @@ int distance_dsp()
   // convert potentiometer_distance to a 1-9 digit
   int valueToDisplay = dis_value[0] - '0';
 
+  // a blank (under 1000 m) or a sign shows 0
+  if (valueToDisplay < 0 || valueToDisplay > 9)
+    valueToDisplay = 0;
+
   // write on the display the value of the sensor (stored in potentiometer_distance)
-  digitalWrite(P1, numbers[valueToDisplay].a);
-  digitalWrite(P2, numbers[valueToDisplay].b);
-  digitalWrite(P3, numbers[valueToDisplay].c);
-  digitalWrite(P4, numbers[valueToDisplay].d);
+  out_digit(numbers[valueToDisplay]);
 
   return 0;
 }
@@ -466,14 +589,14 @@ int distance_dsp()
 int distance_val()
 {
   // check when the button has been activated (pushed and released)
-  buttonState = digitalRead(6);
-  //Serial.println("Button"+String(buttonState));
+  buttonState = button_read();
+  LOG_D(EV_BUTTON, buttonState);
   //if pushed and released then the potentiometer_distance is selected as the actual distance
   if (buttonState != lastButtonState) {
     CURRENT_MODE = buttonState; // change to approach mode
     act_distance = selected_distance; // Make the selected distance as real distance
-    // delay a little bit to avoid debouncing
-    delay(5); // Wait for 5 millisecond(s)
+    distance_rem = 0;
+    LOG_I(EV_LATENCY, button_latency());
   }
   // save the current state as the last state, for
   // the next time through the loop
@@ -488,37 +611,24 @@ int distance_val()
 int actual_distance()
 {
   // Compute the Actual Distance depending on the Actual Speed.
-  double cmp_distance = (speed * elapsedTime) + 0.5*((acc+acc_slope) * (elapsedTime*elapsedTime));
   // Update distance
-  act_distance -= cmp_distance;
+  act_distance -= fx_distance_step(speed, acc+acc_slope, elapsedTime, &distance_rem);
 
   // Check the value of the distance and speed
-  if (act_distance <= 0 && speed <= 10 ) {
+  if (act_distance <= 0 && speed <= 10000 ) {
     // Change to Stope mode
     CURRENT_MODE = 2;
     act_distance = 0;
   }
-  if (act_distance <= 0 && speed >= 10 ) {
+  if (act_distance <= 0 && speed >= 10000 ) {
     // Change to Selection mode
     CURRENT_MODE = 0;
   }
-  Serial.println("ACT DISTANCE: "+String(act_distance));
+  LOG_D(EV_DISTANCE, act_distance);
   // Store the value of distance
-  dtostrf(act_distance,4,0,dis_value);
-  Serial.println("Value DISTANCE: "+String(dis_value));
+  fx_format(dis_value,act_distance,4,0);
   distance_dsp();
-
-  // while there is enough data for a request
-  if ( (request_received) &&
-       (0 == strcmp("DS:  REQ",request)) ) {
-         // Append the Value to the fucntion.
-         sprintf(answer,"DS:%s", dis_value);
-         // set buffers and flags
-         memset(request,'\0', MESSAGE_SIZE+1);
-         request_received = false;
-         answer_requested = true;
-   }
-
+  return 0;
 }
 
 
@@ -528,61 +638,123 @@ int actual_distance()
 int stop_end()
 {
   // check when the button has been activated (pushed and released)
-  buttonStateStop = digitalRead(6);
+  buttonStateStop = button_read();
 
   //if pushed and released then the potentiometer_distance is selected as the actual distance
   if (buttonStateStop != lastButtonStateStop) {
     CURRENT_MODE = 0; // change to distance selection
     timeLast = micros();
-    speed = 0.0;
+    speed = 0;
+    speed_rem = 0;
     //act_distance = selected_distance; // Make the selected distance as real distance
-    // delay a little bit to avoid debouncing
-    delay(5); // Wait for 5 millisecond(s)
+    LOG_I(EV_LATENCY, button_latency());
   }
   // save the current state as the last state, for
   // the next time through the loop
   lastButtonStateStop = buttonStateStop;
 
-    if ( (request_received) &&
-         (0 == strcmp("STP: REQ",request)) ) {
-
-           if (CURRENT_MODE!=2){
-             sprintf(answer,"STP:  GO");
-
-             // set buffers and flags
-             memset(request,'\0', MESSAGE_SIZE+1);
-             request_received = false;
-             answer_requested = true;
-           } else {
-             sprintf(answer,"STP:STOP");
+  return 0;
+}
 
-             // set buffers and flags
-             memset(request,'\0', MESSAGE_SIZE+1);
-             request_received = false;
-             answer_requested = true;
-           }
-    }
+// --------------------------------------
+// Function: command_reply
+// --------------------------------------
+void command_reply(const char *text)
+{
+   uint8_t sreg = SREG;
 
-    return 0;
+   strcpy(current->answer,text);
+   current->answer_size = MESSAGE_SIZE;
 
+   // the answer is complete before requestEvent can see it
+   cli();
+   current->ready = true;
+   SREG = sreg;
 }
 
 // --------------------------------------
-// Function: enable_emg_mode
+// Command handlers
 // --------------------------------------
-int enable_emg_mode(){
-  if ( (request_received) &&
-       (0 == strcmp("ERR: SET",request)) ) {
-         CURRENT_MODE = 3;
-         sprintf(answer,"ERR:  OK");
+void cmd_gas_set() { acc_set(1); command_reply("GAS:  OK"); }
+void cmd_gas_clr() { acc_set(0); command_reply("GAS:  OK"); }
+void cmd_brk_set() { brk_set(1); command_reply("BRK:  OK"); }
+void cmd_brk_clr() { brk_set(0); command_reply("BRK:  OK"); }
+void cmd_mix_set() { out_pin(LED_MIX, HIGH); command_reply("MIX:  OK"); }
+void cmd_mix_clr() { out_pin(LED_MIX, LOW); command_reply("MIX:  OK"); }
+void cmd_lam_set() { lamp_set(1); command_reply("LAM:  OK"); }
+void cmd_lam_clr() { lamp_set(0); command_reply("LAM:  OK"); }
+void cmd_err_set() { CURRENT_MODE = 3; command_reply("ERR:  OK"); }
 
-         // set buffers and flags
-         memset(request,'\0', MESSAGE_SIZE+1);
-         request_received = false;
-         answer_requested = true;
-       }
-  return 0;
+void cmd_act()
 {
+   // '1' sets, '0' clears and any other char keeps the actuator.
+   // The lamps go first and a set wins over a clear, so that
+   // "ACT: 101" accelerates instead of ending with acc = 0
+   const char *request = current->request;
+   if (request[7] == '1' || request[7] == '0') lamp_set(request[7] == '1');
+   if (request[5] == '0') acc_set(0);
+   if (request[6] == '0') brk_set(0);
+   if (request[5] == '1') acc_set(1);
+   if (request[6] == '1') brk_set(1);
+   command_reply("ACT:  OK");
+}
+
+// Handler of each command and the modes (bit m for mode m) that
+// serve it. Read requests never reach the loop.
+#define MODES_RUN 0x07  // 0, 1 and 2
+#define MODES_ALL 0x0F
+static const struct command {
+   void (*run)();
+   uint8_t modes;
+} commands[CMD_COUNT] = {
+   {NULL, 0},                /* CMD_UNKNOWN */
+   {NULL, 0},                /* CMD_SPD_REQ */
+   {NULL, 0},                /* CMD_SLP_REQ */
+   {NULL, 0},                /* CMD_LIT_REQ */
+   {NULL, 0},                /* CMD_DS_REQ */
+   {NULL, 0},                /* CMD_STP_REQ */
+   {NULL, 0},                /* CMD_SNS_REQ */
+   {NULL, 0},                /* CMD_CAP_REQ */
+   {cmd_gas_set, MODES_RUN}, /* CMD_GAS_SET */
+   {cmd_gas_clr, MODES_RUN}, /* CMD_GAS_CLR */
+   {cmd_brk_set, MODES_RUN}, /* CMD_BRK_SET */
+   {cmd_brk_clr, MODES_RUN}, /* CMD_BRK_CLR */
+   {cmd_mix_set, MODES_ALL}, /* CMD_MIX_SET */
+   {cmd_mix_clr, MODES_ALL}, /* CMD_MIX_CLR */
+   {cmd_lam_set, MODES_RUN}, /* CMD_LAM_SET */
+   {cmd_lam_clr, MODES_RUN}, /* CMD_LAM_CLR */
+   {cmd_err_set, MODES_RUN}, /* CMD_ERR_SET */
+   {cmd_act, MODES_RUN},     /* CMD_ACT */
+};
+
+// --------------------------------------
+// Function: command_run
+// --------------------------------------
+void command_run(int mode)
+{
+   uint8_t sreg = SREG;
+   uint8_t head;
+
+   // the slots up to head are complete once it is read
+   cli();
+   head = fifo_head;
+   SREG = sreg;
+
+   // every queued command, in arrival order
+   for (; fifo_run != head; fifo_run++) {
+      current = &fifo[fifo_run % FIFO_SLOTS];
+      if (current->ready)
+         continue;
+      // one lookup, whatever the command. A request the mode does
+      // not serve would otherwise stay pending for ever, answered
+      // MSG:BUSY, and block the bus
+      const struct command *cmd = &commands[current->cmd];
+      if (cmd->run != NULL && (cmd->modes & (1 << mode)))
+         cmd->run();
+      else
+         command_reply("MSG: ERR");
+   }
+}
 
 // --------------------------------------
 // Function: Compute the Speed
@@ -591,42 +763,17 @@ int speed_cmp()
 {
 
    // Set the brightness of speed
-   if(speed >= 40 && speed <= 70){
-      // Invoke the fucntion TransformRange to convert into the range of [0, 255]
-      double brightness = transformRangeSpeed(speed);
-      // Set the Light
-      analogWrite(LED_SPEED, brightness);
+   if(speed >= 40000 && speed <= 70000){
+      // Set the Light, the range of [0, 255]
+      tick_led(fx_range_speed(speed));
    }
    // Set to zero if the speed is not in the range
    else{
-     analogWrite(LED_SPEED, 0);
+     tick_led(0);
    }
 
 }
 
-// --------------------------------------
-// Function: Transform the range of the speed to the range of PWD.
-// --------------------------------------
-double transformRangeSpeed(double value){
-  return (value - 40) * (double)255/30;
-}
-
-// --------------------------------------
-// Function: Transform the range of the lamps to the range of PWD.
-// --------------------------------------
-int transformRangeLamps(int value){
-  return (value - 54) * (float)100/923;
-}
-
-// --------------------------------------
-// Function: Transform the range of the Potenciometer to the range of PWD.
-// --------------------------------------
-double transformRangeDistance(int value){
-  double scale = (double)80000/512;
-  double val1 = (value - 511) * scale  + 10000;
-  return val1;
-}
-
 // --------------------------------------
 // Function: Make the operation to obtain the time to compute the speed
 // --------------------------------------
@@ -674,77 +821,90 @@ void setup()
 
   pinMode(A1, INPUT); // Potenciometer
   pinMode(A0, INPUT); // LDR sensor as Input
-  pinMode(6, INPUT); // Button Input
+
+  // Sample the analog inputs in the background
+  adc_begin();
+  button_begin(); // Button Input, debounced by its pin change interrupt
 
   Serial.begin(9600);
+
+  sprintf(cap_answer,"CAP:%04X",
+          CAP_COMPOUND | CAP_READY_POLL | CAP_REGISTERS | CAP_PIPELINE);
+
+  // first answers, before the loop runs
+  snapshot_update(CURRENT_MODE);
+  snapshot_update(CURRENT_MODE);
+
+  // Start the minor cycles of the loop
+  tick_begin();
 }
 
+// --------------------------------------
+// Handlers of every mode, with their period in minor cycles
+// --------------------------------------
+const struct tick_task selection_tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {distance_req, TICK_CYCLE},
+  {distance_dsp, TICK_CYCLE},
+  {distance_val, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task approach_tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {actual_distance, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task stop_tasks[] = {
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {lamps_req, TICK_CYCLE},
+  {stop_end, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task emergency_tasks[] = {
+  {acc_emg_req, TICK_CYCLE},
+  {brk_emg_req, TICK_CYCLE},
+  {speed_req, TICK_CYCLE},
+  {slope_req, TICK_CYCLE},
+  {lamp_emg_led, TICK_CYCLE},
+  TICK_END,
+};
+const struct tick_task *const mode_tasks[] = {
+  selection_tasks,  // 0: distance selection
+  approach_tasks,   // 1: approaching
+  stop_tasks,       // 2: stop
+  emergency_tasks,  // 3: emergency
+};
+
 // --------------------------------------
 // Function: loop
 // --------------------------------------
 void loop()
 {
-  // Declare the Start Time of the Loop
-  unsigned long start_time = micros();
-  unsigned long end_time = 0;
-  unsigned long lapso = 0;
-  while(true){
-
-    switch(CURRENT_MODE){
-      case 0: // Distance selection mode
-        speed_req();
-        slope_req();
-        acc_req();
-        brk_req();
-        mix_req();
-        lamps_req();
-        lamp_led();
-        distance_req();
-        distance_dsp();
-        distance_val();
-        enable_emg_mode();
-        break;
-
-      case 1: // Approaching mode
-        speed_req();
-        slope_req();
-        acc_req();
-        brk_req();
-        mix_req();
-        lamps_req();
-        lamp_led();
-        actual_distance();
-        enable_emg_mode();
-        break;
-
-      case 2: // Stop mode
-        speed_req();
-        slope_req();
-        acc_req();
-        brk_req();
-        mix_req();
-        lamps_req();
-        lamp_led();
-        stop_end();
-        enable_emg_mode();
-        break;
-      case 3: // Emergency mode
-        acc_emg_req();
-        brk_emg_req();
-        mix_req();
-        speed_req();
-        slope_req();
-        lamp_emg_led();
-        break;
-
-    }
-    // Apply the Sleep Times
-    end_time = micros();
-    lapso = diffULong(start_time,end_time);
-    start_time = start_time + 200000;
-    lapso = lapso/1000;
-    delay(200 - lapso);
+  int mode = CURRENT_MODE;
+
+  // Sample the sensors and move the wagon
+  tick_run(mode_tasks[mode]);
 
+  // Once a cycle, the queued commands and the new answers
+  if (tick_count % TICK_CYCLE == 0) {
+    command_run(mode);
+    snapshot_update(mode);
+    if (CURRENT_MODE != mode)
+      LOG_I(EV_MODE, CURRENT_MODE);
   }
 
+  // Write the outputs that changed
+  out_flush();
+
+  // Print the log in the time left
+  log_flush(log_events);
+
+  // Sleep until the next minor cycle
+  if (tick_wait() > 0)
+    LOG_E(EV_OVERRUN, tick_overruns);
 }
@@ -0,0 +1,114 @@
+// --------------------------------------
+// wagon_adc.h
+//
+// Analog inputs of the sketches: the LDR on A0 and the
+// potentiometer on A1. The ADC runs free and its interrupt
+// alternates the two channels. Every ADC_DECIMATE
+// conversions of a channel are added into one entry of
+// its ring, and the ring keeps a running sum, so
+// adc_read gives the mean of the last
+// ADC_DECIMATE * ADC_RING conversions (about 27 ms) with
+// no wait, in the 0-1023 range of analogRead.
+// --------------------------------------
+#ifndef WAGON_ADC_H
+#define WAGON_ADC_H
+
+#include <Arduino.h>
+
+// --------------------------------------
+// Constants
+// --------------------------------------
+#define ADC_CHANNELS 2   // A0 and A1
+#define ADC_DECIMATE 8   // conversions in a ring entry
+#define ADC_RING 16      // entries, a power of two
+
+// --------------------------------------
+// Types
+// --------------------------------------
+struct adc_channel {
+  uint16_t ring[ADC_RING];  // sums of ADC_DECIMATE conversions
+  uint8_t head;
+  uint16_t acc;             // entry being added up
+  uint8_t count;            // conversions in acc
+  uint32_t sum;             // of the ring
+};
+
+// --------------------------------------
+// Global Variables
+// --------------------------------------
+static volatile struct adc_channel adc_channels[ADC_CHANNELS];
+static volatile uint8_t adc_running = 0;  // channel being converted
+static volatile uint8_t adc_next = 0;     // channel of the next one
+
+// --------------------------------------
+// Handler function: end of a conversion
+//
+// The next conversion has already started with the mux
+// set by the previous call, so this one selects the
+// channel of the conversion after it.
+// --------------------------------------
+ISR(ADC_vect)
+{
+  uint16_t value = ADC;
+  volatile struct adc_channel *c = &adc_channels[adc_running];
+
+  adc_running = adc_next;
+  adc_next = (adc_next + 1) % ADC_CHANNELS;
+  ADMUX = _BV(REFS0) | adc_next;
+
+  c->acc += value;
+  if (++c->count == ADC_DECIMATE) {
+    c->sum += c->acc;
+    c->sum -= c->ring[c->head];
+    c->ring[c->head] = c->acc;
+    c->head = (c->head + 1) % ADC_RING;
+    c->acc = 0;
+    c->count = 0;
+  }
+}
+
+// --------------------------------------
+// Function: adc_begin
+//
+// Fills the rings with one analogRead of every channel
+// and starts the free running conversions.
+// --------------------------------------
+static void adc_begin()
+{
+  uint8_t sreg, i, j;
+  uint16_t value;
+
+  for (i = 0; i < ADC_CHANNELS; i++) {
+    value = analogRead(A0 + i) * ADC_DECIMATE;
+    for (j = 0; j < ADC_RING; j++)
+      adc_channels[i].ring[j] = value;
+    adc_channels[i].sum = (uint32_t)value * ADC_RING;
+  }
+
+  sreg = SREG;
+  cli();
+  DIDR0 |= _BV(ADC0D) | _BV(ADC1D);
+  ADMUX = _BV(REFS0);
+  ADCSRB = 0;  // free running
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) |
+           _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  SREG = sreg;
+}
+
+// --------------------------------------
+// Function: adc_read
+//
+// Filtered reading of pin (A0 or A1), rounded.
+// --------------------------------------
+static int adc_read(uint8_t pin)
+{
+  uint8_t sreg = SREG;
+  uint32_t sum;
+
+  cli();
+  sum = adc_channels[pin - A0].sum;
+  SREG = sreg;
+  return (int)((sum + ADC_DECIMATE * ADC_RING / 2) / (ADC_DECIMATE * ADC_RING));
+}
+
+#endif
@@ -0,0 +1,103 @@
+// --------------------------------------
+// wagon_button.h
+//
+// Debouncer of the distance/stop button on pin 6 (PD6,
+// PCINT22). The pin change interrupt stamps every edge;
+// button_read takes the new level once the pin has been
+// quiet for BUTTON_SETTLE_US, so the loop never waits for
+// the contacts to settle.
+//
+// The stamp of the first edge of a press is kept so the
+// sketch can report how long the press took to change
+// the mode (button_latency).
+// --------------------------------------
+#ifndef WAGON_BUTTON_H
+#define WAGON_BUTTON_H
+
+#include <Arduino.h>
+
+// --------------------------------------
+// Constants
+// --------------------------------------
+#define BUTTON_PIN 6
+#define BUTTON_SETTLE_US 5000UL
+
+// --------------------------------------
+// Global Variables
+// --------------------------------------
+static volatile unsigned long button_first_us = 0;  // first edge of the bounces
+static volatile unsigned long button_edge_us = 0;   // last edge
+static volatile bool button_bouncing = false;
+static int button_level = 0;                // debounced level
+static unsigned long button_change_us = 0;  // first edge of the last change
+
+// --------------------------------------
+// Handler function: pin change of PD0-PD7
+// --------------------------------------
+ISR(PCINT2_vect)
+{
+  unsigned long now = micros();
+  if (!button_bouncing) {
+    button_first_us = now;
+    button_bouncing = true;
+  }
+  button_edge_us = now;
+}
+
+// --------------------------------------
+// Function: button_begin
+//
+// Sets the pin as input, takes its level as the debounced
+// one and enables its pin change interrupt.
+// --------------------------------------
+static void button_begin()
+{
+  pinMode(BUTTON_PIN, INPUT);
+  button_level = digitalRead(BUTTON_PIN);
+  PCMSK2 |= _BV(PCINT22);
+  PCICR |= _BV(PCIE2);
+}
+
+// --------------------------------------
+// Function: button_read
+//
+// Debounced level of the button. It changes when the pin
+// has had no edge for the settle window; until then the
+// previous level is returned.
+// --------------------------------------
+static int button_read()
+{
+  unsigned long first;
+  uint8_t sreg = SREG;
+  bool settled;
+  int level;
+
+  cli();
+  settled = button_bouncing && micros() - button_edge_us >= BUTTON_SETTLE_US;
+  if (settled)
+    button_bouncing = false;
+  first = button_first_us;
+  SREG = sreg;
+
+  if (settled) {
+    level = digitalRead(BUTTON_PIN);
+    if (level != button_level) {
+      button_level = level;
+      button_change_us = first;
+    }
+  }
+  return button_level;
+}
+
+// --------------------------------------
+// Function: button_latency
+//
+// Time in us from the first edge of the last change of the
+// debounced level to now.
+// --------------------------------------
+static unsigned long button_latency()
+{
+  return micros() - button_change_us;
+}
+
+#endif
@@ -0,0 +1,138 @@
+// --------------------------------------
+// wagon_fixed.h
+//
+// Fixed-point physics and range transforms of the wagon,
+// for arduino_codeD.ino (the ATmega has no FPU) and for
+// the physics model of the host build, so both compute
+// the same numbers.
+//
+// Units: speed in mm/s, acceleration in mm/s2, distance
+// in mm, time in ms. Every step returns the part that
+// does not fit the unit in *rem, to be passed to the next
+// step, so the rounding does not add up over the ticks.
+// --------------------------------------
+#ifndef WAGON_FIXED_H
+#define WAGON_FIXED_H
+
+// --------------------------------------
+// Constants
+// --------------------------------------
+#define FX_ACC_DOWN 250
+#define FX_ACC_UP -250
+#define FX_ACC_FLAT 0
+#define FX_ACC 500
+#define FX_BRAKE -500
+
+// --------------------------------------
+// Function: fx_speed_step
+//
+// Speed after dt ms at acc. *rem is in mm/s / 1000.
+// --------------------------------------
+static inline long fx_speed_step(long speed, int acc, unsigned long dt, long *rem)
+{
+  long dv = (long)acc * (long)dt + *rem;
+  *rem = dv % 1000;
+  return speed + dv / 1000;
+}
+
+// --------------------------------------
+// Function: fx_distance_step
+//
+// Distance run in dt ms at the speed reached at the end of
+// the step with acc, speed*dt + acc*dt^2/2 as the original
+// code computes it. *rem is in um.
+// --------------------------------------
+static inline long fx_distance_step(long speed, int acc, unsigned long dt, long *rem)
+{
+  long um = speed * (long)dt + ((long)acc * (long)dt / 2) * (long)dt / 1000 + *rem;
+  *rem = um % 1000;
+  return um / 1000;
+}
+
+// --------------------------------------
+// Function: fx_range_speed
+//
+// PWM of the speed led, 40-70 m/s to 0-255.
+// --------------------------------------
+static inline int fx_range_speed(long speed)
+{
+  return (int)((speed - 40000) * 255 / 30000);
+}
+
+// --------------------------------------
+// Function: fx_range_lamps
+//
+// LDR reading to light in %.
+// --------------------------------------
+static inline int fx_range_lamps(int value)
+{
+  return (int)((long)(value - 54) * 100 / 923);
+}
+
+// --------------------------------------
+// Function: fx_range_distance
+//
+// Potentiometer reading to distance in mm, 156.25 m a step
+// from 10000 m at 511.
+// --------------------------------------
+static inline long fx_range_distance(int value)
+{
+  return (long)(value - 511) * 156250 + 10000000L;
+}
+
+// --------------------------------------
+// Function: fx_format
+//
+// Writes value/1000 with decimals (0-3) digits, rounded
+// half away from zero and right aligned in width chars,
+// like dtostrf but without the sign of a value that
+// rounds to 0. buf needs width+1 or 13 chars.
+// --------------------------------------
+static inline char *fx_format(char *buf, long value, int width, int decimals)
+{
+  char tmp[13];
+  unsigned long mag = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+  unsigned long unit = 1000;
+  int n = 0, len, i, negative;
+
+  for (i = 0; i < decimals; i++)
+    unit /= 10;
+  mag = (mag + unit / 2) / unit;
+  negative = value < 0 && mag > 0;
+
+  // digits in reverse, then the sign
+  for (i = 0; i < decimals; i++, mag /= 10)
+    tmp[n++] = '0' + mag % 10;
+  if (decimals > 0)
+    tmp[n++] = '.';
+  do {
+    tmp[n++] = '0' + mag % 10;
+    mag /= 10;
+  } while (mag > 0);
+  if (negative)
+    tmp[n++] = '-';
+
+  len = n < width ? width : n;
+  for (i = 0; i < len - n; i++)
+    buf[i] = ' ';
+  for (; i < len; i++)
+    buf[i] = tmp[--n];
+  buf[len] = '\0';
+  return buf;
+}
+
+// --------------------------------------
+// Function: fx_digits
+//
+// Writes the n last digits of value >= 0, zero padded.
+// Returns the end of what was written.
+// --------------------------------------
+static inline char *fx_digits(char *buf, long value, int n)
+{
+  int i;
+  for (i = n - 1; i >= 0; i--, value /= 10)
+    buf[i] = '0' + value % 10;
+  return buf + n;
+}
+
+#endif
@@ -0,0 +1,132 @@
+// --------------------------------------
+// wagon_log.h
+//
+// Logger of the Arduino sketches. A message is an event
+// id and a 32-bit value, stored binary in a ring that
+// loop() drains to Serial in its idle time, only as much
+// as the serial buffer takes without blocking. log_put is
+// safe in the Wire handlers, which do no serial I/O.
+//
+// Messages above LOG_LEVEL (define it before including
+// this file) compile to nothing.
+// --------------------------------------
+#ifndef WAGON_LOG_H
+#define WAGON_LOG_H
+
+#include <Arduino.h>
+
+// --------------------------------------
+// Constants
+// --------------------------------------
+#define LOG_NONE 0
+#define LOG_ERROR 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_ERROR
+#endif
+
+#define LOG_RING 16  // entries, a power of two
+#define LOG_LINE 24  // longest line log_flush writes
+
+// --------------------------------------
+// Types
+// --------------------------------------
+struct log_event {
+  const char *name;
+  uint8_t text;  // the value holds 4 chars, see log_text
+};
+
+struct log_entry {
+  uint8_t event;
+  long value;
+};
+
+// --------------------------------------
+// Global Variables
+// --------------------------------------
+static struct log_entry log_ring[LOG_RING];
+static volatile uint8_t log_head = 0;  // next entry to write
+static volatile uint8_t log_tail = 0;  // next entry to print
+static volatile uint8_t log_dropped = 0;
+
+// --------------------------------------
+// Function: log_text
+//
+// First 4 chars of s packed in a value.
+// --------------------------------------
+static inline long log_text(const char *s)
+{
+  return (long)((uint32_t)(uint8_t)s[0] | (uint32_t)(uint8_t)s[1] << 8 |
+                (uint32_t)(uint8_t)s[2] << 16 | (uint32_t)(uint8_t)s[3] << 24);
+}
+
+// --------------------------------------
+// Function: log_put
+//
+// Stores a message, or counts it as dropped if the ring is
+// full. Callable from the loop and from interrupts.
+// --------------------------------------
+static inline void log_put(uint8_t event, long value)
+{
+  uint8_t sreg = SREG;
+  cli();
+  if ((uint8_t)(log_head - log_tail) < LOG_RING) {
+    log_ring[log_head % LOG_RING].event = event;
+    log_ring[log_head % LOG_RING].value = value;
+    log_head++;
+  } else if (log_dropped < 255) {
+    log_dropped++;
+  }
+  SREG = sreg;
+}
+
+// --------------------------------------
+// Function: log_flush
+//
+// Prints the stored messages with the names of events
+// while the serial buffer has room for a line.
+// --------------------------------------
+static void log_flush(const struct log_event *events)
+{
+  while (log_tail != log_head && Serial.availableForWrite() >= LOG_LINE) {
+    // the producers never write the entries from tail to head
+    const struct log_entry *e = &log_ring[log_tail % LOG_RING];
+    Serial.print(events[e->event].name);
+    Serial.print(' ');
+    if (events[e->event].text) {
+      for (uint8_t i = 0; i < 4; i++)
+        Serial.print((char)((unsigned long)e->value >> (8 * i)));
+      Serial.println();
+    } else {
+      Serial.println(e->value);
+    }
+    log_tail++;
+  }
+  if (log_dropped > 0 && Serial.availableForWrite() >= LOG_LINE) {
+    Serial.print("LOG dropped ");
+    Serial.println(log_dropped);
+    log_dropped = 0;
+  }
+}
+
+// --------------------------------------
+// Macros: one per level
+// --------------------------------------
+#if LOG_LEVEL >= LOG_ERROR
+#define LOG_E(event, value) log_put(event, (long)(value))
+#else
+#define LOG_E(event, value) do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_INFO
+#define LOG_I(event, value) log_put(event, (long)(value))
+#else
+#define LOG_I(event, value) do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_DEBUG
+#define LOG_D(event, value) log_put(event, (long)(value))
+#else
+#define LOG_D(event, value) do { } while (0)
+#endif
+
+#endif
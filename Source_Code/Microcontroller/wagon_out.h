@@ -0,0 +1,101 @@
+// --------------------------------------
+// wagon_out.h
+//
+// Digital outputs of the sketches: the leds on pins 7 and
+// 11-13 and the BCD input of the display on pins 2-5
+// (P1-P4, bit a to d). The handlers set the levels in a
+// shadow of PORTB and PORTD; out_flush writes each port
+// in one store, only when its shadow changed. Pins of the
+// ports outside the masks (inputs, serial, the PWM of
+// pin 10) are left as they are.
+// --------------------------------------
+#ifndef WAGON_OUT_H
+#define WAGON_OUT_H
+
+#include <Arduino.h>
+
+// --------------------------------------
+// Constants
+// --------------------------------------
+#define OUT_MASK_B (_BV(3) | _BV(4) | _BV(5))  // pins 11-13
+#define OUT_MASK_D (_BV(2) | _BV(3) | _BV(4) | _BV(5) | _BV(7))  // 2-5, 7
+#define OUT_DIGIT_SHIFT 2                      // P1 on PD2
+
+// --------------------------------------
+// Global Variables
+// --------------------------------------
+static uint8_t out_b = 0;        // levels wanted
+static uint8_t out_d = 0;
+static uint8_t out_b_port = 0;   // levels written
+static uint8_t out_d_port = 0;
+
+// --------------------------------------
+// Function: out_pin
+//
+// Sets the level of an output pin of the masks.
+// --------------------------------------
+static inline void out_pin(uint8_t pin, uint8_t level)
+{
+  if (pin >= 8) {
+    if (level)
+      out_b |= _BV(pin - 8);
+    else
+      out_b &= ~_BV(pin - 8);
+  } else {
+    if (level)
+      out_d |= _BV(pin);
+    else
+      out_d &= ~_BV(pin);
+  }
+}
+
+// --------------------------------------
+// Function: out_level
+//
+// Level set for an output pin, written or not yet.
+// --------------------------------------
+static inline uint8_t out_level(uint8_t pin)
+{
+  if (pin >= 8)
+    return (out_b & _BV(pin - 8)) ? HIGH : LOW;
+  return (out_d & _BV(pin)) ? HIGH : LOW;
+}
+
+// --------------------------------------
+// Function: out_digit
+//
+// Puts a BCD nibble on P1-P4.
+// --------------------------------------
+static inline void out_digit(uint8_t bcd)
+{
+  out_d = (out_d & ~(0x0F << OUT_DIGIT_SHIFT)) | (bcd & 0x0F) << OUT_DIGIT_SHIFT;
+}
+
+// --------------------------------------
+// Function: out_flush
+//
+// Writes the ports whose levels changed. The interrupts
+// are held off from the read to the store, as they may
+// write the other pins of the port.
+// --------------------------------------
+static void out_flush()
+{
+  uint8_t sreg;
+
+  if (out_b != out_b_port) {
+    sreg = SREG;
+    cli();
+    PORTB = (PORTB & ~OUT_MASK_B) | (out_b & OUT_MASK_B);
+    SREG = sreg;
+    out_b_port = out_b;
+  }
+  if (out_d != out_d_port) {
+    sreg = SREG;
+    cli();
+    PORTD = (PORTD & ~OUT_MASK_D) | (out_d & OUT_MASK_D);
+    SREG = sreg;
+    out_d_port = out_d;
+  }
+}
+
+#endif
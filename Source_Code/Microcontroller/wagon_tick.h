@@ -0,0 +1,159 @@
+// --------------------------------------
+// wagon_tick.h
+//
+// Time base of the Arduino sketches. Timer1 runs in fast
+// PWM mode (14) at 1 kHz: its compare match A interrupt
+// counts milliseconds and its channel B drives the speed
+// led on pin 10 (OC1B), which analogWrite can no longer
+// use once the timer is reprogrammed.
+//
+// loop() runs in minor cycles of TICK_MINOR_MS. tick_wait
+// sleeps until the next release and counts the cycles
+// that ran past it; tick_run runs the entries of a
+// handler set whose period (in minor cycles) is due, so
+// a task can run faster or slower than the 200 ms cycle.
+// --------------------------------------
+#ifndef WAGON_TICK_H
+#define WAGON_TICK_H
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+// --------------------------------------
+// Constants
+// --------------------------------------
+#define TICK_TOP 1999        // 16 MHz / 8 / 2000 = 1 kHz
+#define TICK_PWM_PIN 10      // OC1B
+#define TICK_MINOR_MS 50
+#define TICK_CYCLE 4         // minor cycles in the 200 ms cycle
+
+// --------------------------------------
+// Types
+// --------------------------------------
+struct tick_task {
+  int (*run)();
+  uint8_t period;  // minor cycles, TICK_CYCLE for every 200 ms
+};
+
+// Last entry of a handler set
+#define TICK_END {NULL, 0}
+
+// --------------------------------------
+// Global Variables
+// --------------------------------------
+static volatile uint16_t tick_ms = 0;  // counted by the timer
+static uint16_t tick_release = 0;      // start of the current cycle
+static unsigned long tick_count = 0;   // minor cycles run
+static unsigned int tick_overruns = 0;
+static int tick_led_value = 0;         // duty cycle of pin 10
+
+// --------------------------------------
+// Handler function: Timer1 compare match A, every ms
+// --------------------------------------
+ISR(TIMER1_COMPA_vect)
+{
+  tick_ms++;
+}
+
+// --------------------------------------
+// Function: tick_now
+// --------------------------------------
+static inline uint16_t tick_now()
+{
+  uint8_t sreg = SREG;
+  uint16_t now;
+  cli();
+  now = tick_ms;
+  SREG = sreg;
+  return now;
+}
+
+// --------------------------------------
+// Function: tick_begin
+//
+// Programs Timer1 and starts the first minor cycle now.
+// --------------------------------------
+static void tick_begin()
+{
+  uint8_t sreg = SREG;
+
+  pinMode(TICK_PWM_PIN, OUTPUT);
+  digitalWrite(TICK_PWM_PIN, LOW);
+  cli();
+  TCCR1A = _BV(WGM11);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS11);
+  ICR1 = TICK_TOP;
+  OCR1A = 0;
+  OCR1B = 0;
+  TCNT1 = 0;
+  TIMSK1 = _BV(OCIE1A);
+  SREG = sreg;
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  tick_release = tick_now();
+}
+
+// --------------------------------------
+// Function: tick_led
+//
+// Duty cycle of pin 10, 0-255 as for analogWrite. The
+// output is left to the port at 0, where the PWM would
+// still give a one count pulse. The timer is only written
+// when the value changes.
+// --------------------------------------
+static void tick_led(int value)
+{
+  value = constrain(value, 0, 255);
+  if (value == tick_led_value)
+    return;
+  tick_led_value = value;
+  if (value == 0) {
+    TCCR1A &= ~_BV(COM1B1);
+    digitalWrite(TICK_PWM_PIN, LOW);
+  } else {
+    OCR1B = (uint16_t)((unsigned long)value * TICK_TOP / 255);
+    TCCR1A |= _BV(COM1B1);
+  }
+}
+
+// --------------------------------------
+// Function: tick_run
+//
+// Runs the entries of set that are due in this cycle.
+// --------------------------------------
+static void tick_run(const struct tick_task *set)
+{
+  for (; set->run != NULL; set++) {
+    if (tick_count % set->period == 0)
+      set->run();
+  }
+}
+
+// --------------------------------------
+// Function: tick_wait
+//
+// Sleeps until the release of the next minor cycle. If
+// the cycle that ends ran past it, starts at once, skips
+// any release that is already gone and returns the number
+// of overruns (1 + the skipped ones), otherwise 0.
+// --------------------------------------
+static unsigned int tick_wait()
+{
+  uint16_t late;
+  unsigned int missed = 0;
+
+  tick_release += TICK_MINOR_MS;
+  late = tick_now() - tick_release;
+  if (late != 0 && late < 0x8000) {
+    missed = 1 + late / TICK_MINOR_MS;
+    tick_release += (missed - 1) * TICK_MINOR_MS;
+    tick_overruns += missed;
+  }
+  // any interrupt wakes the board, at least the ms one
+  while ((int16_t)(tick_now() - tick_release) < 0)
+    sleep_mode();
+  tick_count++;
+  return missed;
+}
+
+#endif